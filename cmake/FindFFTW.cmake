@@ -12,8 +12,18 @@ IF(FFTW_INCLUDE_DIR AND FFTW_LIBRARY AND FFTWF_LIBRARY)
   SET(FFTW_FOUND TRUE)
 ENDIF()
 
+# optional: multithreaded transforms (single precision)
+FIND_LIBRARY(FFTWF_THREADS_LIBRARY NAMES fftw3f_threads ${FFTW_LIBRARY_DIRS})
+SET(FFTW_THREADS_FOUND FALSE)
+IF(FFTW_FOUND AND FFTWF_THREADS_LIBRARY)
+  FIND_PACKAGE_MESSAGE(FFTW_THREADS "Found FFTW threads: ${FFTWF_THREADS_LIBRARY}" "[${FFTWF_THREADS_LIBRARY}]")
+  SET(FFTW_THREADS_FOUND TRUE)
+ENDIF()
+
 MARK_AS_ADVANCED(
    FFTW_INCLUDE_DIR
    FFTW_LIBRARIES
    FFTW_FOUND
+   FFTWF_THREADS_LIBRARY
+   FFTW_THREADS_FOUND
 )
@@ -53,4 +53,24 @@ void setPixelsize(const int sz) {
     settings.setValue("storm/pixelsize", sz);
 }
 
+QString method() {
+    QSettings settings;
+    return settings.value("storm/method", "spline").toString();
+}
+
+void setMethod(const QString& method) {
+    QSettings settings;
+    settings.setValue("storm/method", method);
+}
+
+QString previewMethod() {
+    QSettings settings;
+    return settings.value("storm/previewMethod", "quicklook").toString();
+}
+
+void setPreviewMethod(const QString& method) {
+    QSettings settings;
+    settings.setValue("storm/previewMethod", method);
+}
+
 } // namespace Config
@@ -29,6 +29,10 @@ namespace Config {
     void setRoilen(const int roilen);
     int pixelsize();
     void setPixelsize(const int sz);
+    QString method();
+    void setMethod(const QString& method);
+    QString previewMethod();
+    void setPreviewMethod(const QString& method);
     
 } // namespace Config
 
@@ -33,7 +33,7 @@
 #include <qdebug.h>
 #include <QMessageBox>
 #include <QProgressDialog>
-#include <set>
+#include <vector>
 
 #include "fftfilter.hxx"
 #include "myimportinfo.h"
@@ -60,6 +60,7 @@ MainController::MainController(MainWindow * window)
     m_model->setFactor(m_stormparamsDialog->factor());
     m_model->setFilterFilename(Config::filterFilename());
     m_model->setRoilen(Config::roilen());
+    m_model->setMethod(Config::method());
     m_model->setPreviewEnabled(m_stormparamsDialog->previewEnabled());
 
     showStormparamsDialog();
@@ -103,13 +104,18 @@ void MainController::showSettingsDialog()
     settings->setFilterFilename(Config::filterFilename());
     settings->setRoilen(Config::roilen());
     settings->setPixelsize(Config::pixelsize());
+    settings->setMethod(Config::method());
+    settings->setPreviewMethod(Config::previewMethod());
     int result = settings->exec();
     if(result==QDialog::Accepted) {
         Config::setFilterFilename(settings->filterFilename());
         Config::setRoilen(settings->roilen());
         Config::setPixelsize(settings->pixelsize());
+        Config::setMethod(settings->method());
+        Config::setPreviewMethod(settings->previewMethod());
         m_model->setFilterFilename(settings->filterFilename());
         m_model->setRoilen(settings->roilen());
+        m_model->setMethod(settings->method());
     }
     return;
 }
@@ -150,10 +156,28 @@ void MainController::runStorm()
         range.append(i);
     }
     FFTFilter<float>* fftwWrapper = storm::createFFTFilter<float>(info);
-    QFuture<std::set<Coord<float> > > result = QtConcurrent::mapped(range, StormProcessor<float>(info, m_model, fftwWrapper));
+
+    // With the preview enabled, the live preview shows a quick look at
+    // the stack (Config::previewMethod(), quicklook by default) instead of
+    // the results of the full run. The quick look is started first, so it
+    // gets the threads of the pool and covers the whole stack long before
+    // the full run is done. The results of the full run are saved.
+    const bool quicklookPreview = m_model->previewEnabled() && Config::previewMethod() != "";
+    QFuture<std::vector<Coord<float> > > quicklookResult;
+    QFutureWatcher<void> quicklookWatcher;
+    if(quicklookPreview) {
+        StormProcessor<float> quicklook(info, m_model, fftwWrapper);
+        quicklook.setMethod(localizationMethodFromString(Config::previewMethod().toStdString()));
+        quicklookResult = QtConcurrent::mapped(range, quicklook);
+        quicklookWatcher.setFuture(quicklookResult);
+        connect(&progressDialog, SIGNAL(canceled()), &quicklookWatcher, SLOT(cancel()));
+    }
+
+    QFuture<std::vector<Coord<float> > > result = QtConcurrent::mapped(range, StormProcessor<float>(info, m_model, fftwWrapper));
     futureWatcher.setFuture(result);
 
-    PreviewImage previewImage(m_model, info->shape(), result, m_view->maxImgWidth(), m_view->maxImgHeight());
+    PreviewImage previewImage(m_model, info->shape(), quicklookPreview ? quicklookResult : result, 
+            m_view->maxImgWidth(), m_view->maxImgHeight());
     PreviewTimer previewTimer(&previewImage);
     connect(&previewTimer, SIGNAL(previewChanged(QImage)), m_view, SLOT(setPreview(QImage)));
     if(m_model->previewEnabled()) {
@@ -163,11 +187,13 @@ void MainController::runStorm()
     TIC;
     progressDialog.exec();
     futureWatcher.waitForFinished();
+    quicklookWatcher.waitForFinished();
     previewTimer.stop();
     TOC;
 
-    storm::saveResults(m_model, info->shape(), QVector<std::set<Coord<float> > >::fromList(result.results()).toStdVector()); // save results // TODO
-    m_view->setPreview(previewImage.getPreviewImage());
+    storm::saveResults(m_model, info->shape(), QVector<std::vector<Coord<float> > >::fromList(result.results()).toStdVector()); // save results // TODO
+    PreviewImage resultImage(m_model, info->shape(), result, m_view->maxImgWidth(), m_view->maxImgHeight());
+    m_view->setPreview(resultImage.getPreviewImage());
     delete fftwWrapper;
     delete info;
     QMessageBox::information(m_view, "storm", "The data have successfully been processed and the result image and coordinates saved to disk.");
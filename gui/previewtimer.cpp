@@ -100,7 +100,7 @@ class GrayToRGBAAccessor
 } // namespace vigra
 
 PreviewImage::PreviewImage(const StormModel* const model, const vigra::Shape3& shape, 
-            const QFuture<std::set<Coord<float> > >& futureResult, 
+            const QFuture<std::vector<Coord<float> > >& futureResult, 
             const int maxwidth, const int maxheight)
     : m_model(model),
     m_shape(shape),
@@ -135,8 +135,8 @@ QImage PreviewImage::getPreviewImage()
     // resulting image
     int resultCount = m_futureResult.resultCount();
     for(int i = m_processedIndex; i < resultCount; ++i) {
-        const std::set<Coord<float> > coords = m_futureResult.resultAt(i);
-        std::set<Coord<float> >::const_iterator it2;
+        const std::vector<Coord<float> > coords = m_futureResult.resultAt(i);
+        std::vector<Coord<float> >::const_iterator it2;
 
         for(it2 = coords.begin(); it2 != coords.end(); it2++) {
             const Coord<float>& c = *it2;
@@ -35,7 +35,7 @@ template <class T> class Coord;
 class PreviewImage
 {
     public:
-        PreviewImage(const StormModel* const, const vigra::Shape3&, const QFuture<std::set<Coord<float> > >& futureResult,
+        PreviewImage(const StormModel* const, const vigra::Shape3&, const QFuture<std::vector<Coord<float> > >& futureResult,
                 const int maxwidth=-1, const int maxheight=-1);
         ~PreviewImage();
         QImage getPreviewImage();
@@ -48,7 +48,7 @@ class PreviewImage
         const vigra::Shape3 m_shape;
         int m_newwidth;
         int m_newheight;
-        const QFuture<std::set<Coord<float> > >& m_futureResult;
+        const QFuture<std::vector<Coord<float> > >& m_futureResult;
         unsigned int m_processedIndex;
         float m_scale;
 };
@@ -33,6 +33,19 @@ SettingsDialog::SettingsDialog(QWidget * parent)
     roilen << "Fast (ROI 5px)" << "Accurate (ROI 9px)";
     roival << 5                << 9;
     setRoilenAlternatives(roilen, roival);
+
+    // values as understood by localizationMethodFromString()
+    m_method->addItem("Spline upsampling", QVariant("spline"));
+    m_method->addItem("Fourier upsampling", QVariant("fourier"));
+    m_method->addItem("Newton refinement", QVariant("newton"));
+    m_method->addItem("Gaussian fit (MLE)", QVariant("mle"));
+    m_method->addItem("Spline upsampling of the peaks", QVariant("peak"));
+    m_method->addItem("Quick look (no upsampling)", QVariant("quicklook"));
+
+    // method of the live preview, quicklook by default
+    m_previewMethod->addItem("Results of the full run", QVariant(""));
+    m_previewMethod->addItem("Quick look (no upsampling)", QVariant("quicklook"));
+    m_previewMethod->addItem("Newton refinement", QVariant("newton"));
 }
 
 SettingsDialog::~SettingsDialog()
@@ -77,3 +90,17 @@ void SettingsDialog::setRoilen(const int roilen) {
 void SettingsDialog::setPixelsize(const int sz) {
     m_pixelsize->setValue(sz);
 }
+
+void SettingsDialog::setMethod(const QString& method) {
+    int idx = m_method->findData(QVariant(method));
+    if(idx >= 0) {
+        m_method->setCurrentIndex(idx);
+    }
+}
+
+void SettingsDialog::setPreviewMethod(const QString& method) {
+    int idx = m_previewMethod->findData(QVariant(method));
+    if(idx >= 0) {
+        m_previewMethod->setCurrentIndex(idx);
+    }
+}
@@ -33,11 +33,15 @@ class SettingsDialog : public QDialog, private Ui::SettingsDialog
         QString filterFilename() { return m_filterFilename->text(); }
         int roilen() { return m_roilen->itemData(m_roilen->currentIndex()).toInt(); }
         int pixelsize() { return m_pixelsize->value(); }
+        QString method() { return m_method->itemData(m_method->currentIndex()).toString(); }
+        QString previewMethod() { return m_previewMethod->itemData(m_previewMethod->currentIndex()).toString(); }
     public slots:
         void setFilterFilename(const QString &);
         void setRoilenAlternatives(const QList<QString>& desc, const QList<int>& value);
         void setRoilen(const int roilen);
         void setPixelsize(const int sz);
+        void setMethod(const QString& method);
+        void setPreviewMethod(const QString& method);
     private slots:
         void selectFilterFile();
         
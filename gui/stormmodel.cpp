@@ -24,7 +24,8 @@
 
 StormModel::StormModel(QObject * parent) 
     : QObject(parent),
-    m_roilen(9)
+    m_roilen(9),
+    m_method("spline")
 {
 }
 
@@ -62,3 +63,8 @@ void StormModel::setPreviewEnabled(const bool enabled)
 {
     m_previewEnabled = enabled;
 }
+
+void StormModel::setMethod(const QString & m)
+{
+    m_method = m;
+}
@@ -24,7 +24,6 @@
 #include <vigra/multi_array.hxx>
 #include <vigra/basicimage.hxx>
 #include <vector>
-#include <set>
 
 class MyImportInfo;
 
@@ -41,12 +40,14 @@ class StormModel : public QObject
         void setInputFilename(const QString&);
         void setFilterFilename(const QString&);
         void setPreviewEnabled(const bool);
+        void setMethod(const QString&);
         QString filterFilename() const { return m_filterFilename; }
         QString inputFilename() const { return m_inputFilename; }
         int threshold() const { return m_threshold; }
         int factor() const { return m_factor; }
         int roilen() const { return m_roilen; }
         bool previewEnabled() const { return m_previewEnabled; }
+        QString method() const { return m_method; }
 
     private:
         int m_threshold;
@@ -55,6 +56,7 @@ class StormModel : public QObject
         QString m_filterFilename;
         int m_roilen;
         bool m_previewEnabled;
+        QString m_method;
 
 };
 
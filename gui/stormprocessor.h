@@ -26,30 +26,43 @@
 #include "stormmodel.h"
 #include <QFuture>
 #include <QMessageBox>
+#include <QThreadStorage>
 template <class T>
 class Coord;
 
 template <class T>
 class FFTFilter;
+
+template <class T>
+class FrameWorkspace;
+
 class QImage;
 
 template <class T>
 class StormProcessor
 {
     public:
-        typedef std::set<Coord<T> > result_type;
+        typedef std::vector<Coord<T> > result_type;
         StormProcessor(const MyImportInfo* const info, const StormModel* const model, FFTFilter<T>* fftwWrapper);
         ~StormProcessor();
-        std::set<Coord<T> > operator()(const int i) const {return executeFrame(i);}
-        std::set<Coord<T> > executeFrame(const int i) const;
+        std::vector<Coord<T> > operator()(const int i) const {return executeFrame(i);}
+        std::vector<Coord<T> > executeFrame(const int i) const;
+        void setMethod(const LocalizationMethod method) { m_options.method = method; }
 
     private:
+        // memory of a thread that is kept from frame to frame
+        struct ThreadData {
+            FrameWorkspace<T> workspace;
+            MultiArray<3,T> in; // current frame, w x h x 1
+        };
+
         const MyImportInfo * const m_info;
         vigra::BasicImage<float> m_filter;
         vigra::MultiArrayShape<3>::type m_shape;
         int m_threshold;
         int m_factor;
         int m_roilen;
+        StormOptions m_options;
         FFTFilter<T>* m_fftwWrapper;
 };
 
@@ -64,6 +77,7 @@ StormProcessor<T>::StormProcessor(const MyImportInfo* const info, const StormMod
     m_roilen(model->roilen()),
     m_fftwWrapper(fftwWrapper)
 {
+    m_options.method = localizationMethodFromString(model->method().toStdString());
     try {
         vigra::exportImage(vigra::srcImageRange(m_filter), vigra::ImageExportInfo("daaaa.png"));
         // load filter image
@@ -76,6 +90,7 @@ StormProcessor<T>::StormProcessor(const MyImportInfo* const info, const StormMod
         vigra::BasicImage<T> filterIn(filterinfo.width(), filterinfo.height());
         vigra::importImage(filterinfo, destImage(filterIn)); // read the image
         vigra::resizeImageSplineInterpolation(srcImageRange(filterIn), destImageRange(m_filter));
+        m_options.psfWidth = estimatePSFWidth(m_filter);
     } catch (vigra::StdException & e) {
         QMessageBox::critical(0, "storm", "Filter file could not be opened");
         vigra_fail("filter could not be opened"); // TODO: make this class a QObject, emit Signal from here to notify app.
@@ -89,14 +104,26 @@ StormProcessor<T>::~StormProcessor()
 }
 
 template <class T>
-std::set<Coord<T> > StormProcessor<T>::executeFrame(const int frame) const
+std::vector<Coord<T> > StormProcessor<T>::executeFrame(const int frame) const
 {
-    MultiArray<3,T> in(vigra::Shape3(m_shape[0],m_shape[1],1)); //w x h x 1
-    readBlock(*m_info, vigra::Shape3(0,0,frame), vigra::Shape3(m_shape[0],m_shape[1],1), in);
-    std::set<Coord<T> > maxima_coords;
-    MultiArrayView <2, T> in2 = in.bindOuter(0); // select current image
+    // QtConcurrent runs the frames in a thread pool. Every thread keeps
+    // its own workspace and frame buffer, so they are not reallocated 
+    // for every frame.
+    static QThreadStorage<ThreadData*> threadData;
+    if(!threadData.hasLocalData()) {
+        threadData.setLocalData(new ThreadData());
+    }
+    ThreadData & data = *threadData.localData();
+    const vigra::Shape3 shape(m_shape[0],m_shape[1],1);
+    if(data.in.shape() != shape) {
+        data.in.reshape(shape);
+    }
+    readBlock(*m_info, vigra::Shape3(0,0,frame), shape, data.in);
+    std::vector<Coord<T> > maxima_coords;
+    MultiArrayView <2, T> in2 = data.in.bindOuter(0); // select current image
     wienerStormSingleFrame( in2, m_filter, maxima_coords,
-            *m_fftwWrapper, (T)m_threshold, m_factor, m_roilen);
+            *m_fftwWrapper, data.workspace, (T)m_threshold, m_factor, m_roilen,
+            0, m_options);
 
     return maxima_coords;
 }
@@ -104,7 +131,7 @@ std::set<Coord<T> > StormProcessor<T>::executeFrame(const int frame) const
 namespace storm
 {
     template <class T>
-    void saveResults(const StormModel* const model, const vigra::Shape3& shape, const std::vector<std::set<Coord<T> > >& res); /**< save results and close all file pointers */
+    void saveResults(const StormModel* const model, const vigra::Shape3& shape, const std::vector<std::vector<Coord<T> > >& res); /**< save results and close all file pointers */
     void executeStormImages(const int from, const int to); /**< run storm algorithm */
 
     template <class T>
@@ -133,7 +160,7 @@ FFTFilter<T>* createFFTFilter(const MyImportInfo* const info)
 }
 
 template <class T>
-void saveResults(const StormModel* const model, const vigra::Shape3& shape, const std::vector<std::set<Coord<T> > >& coords)
+void saveResults(const StormModel* const model, const vigra::Shape3& shape, const std::vector<std::vector<Coord<T> > >& coords)
 {
     // save coordinates list and result image
     size_t pos = model->inputFilename().toStdString().find_last_of('.');
@@ -156,7 +183,8 @@ void saveResults(const StormModel* const model, const vigra::Shape3& shape, cons
 
     int numSpots = 0;
     if(coordsfile != "") {
-        numSpots = saveCoordsFile(coordsfile, coords, shape, factor);
+        bool withUncertainty = localizationMethodFromString(model->method().toStdString()) == MLE_FIT;
+        numSpots = saveCoordsFile(coordsfile, coords, shape, factor, withUncertainty);
     }
     qDebug() << QString("found %1 spots.").arg(numSpots);
 
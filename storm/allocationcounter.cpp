@@ -0,0 +1,100 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+// Replacement of the global operator new that counts the allocations,
+// only compiled with STORM_COUNT_ALLOCATIONS (see allocationcounter.hxx).
+
+#include <cstdlib>
+#include <new>
+#include "allocationcounter.hxx"
+
+#if __cplusplus >= 201103L
+    #define STORM_THROW_BAD_ALLOC
+    #define STORM_NO_THROW noexcept
+#else
+    #define STORM_THROW_BAD_ALLOC throw(std::bad_alloc)
+    #define STORM_NO_THROW throw()
+#endif
+
+static unsigned long allocations = 0;
+
+void countAllocation() {
+    #pragma omp atomic
+    ++allocations;
+}
+
+unsigned long allocationCount() {
+    #pragma omp flush
+    return allocations;
+}
+
+static void * allocate(std::size_t size) {
+    countAllocation();
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void * operator new(std::size_t size) STORM_THROW_BAD_ALLOC {
+    void * p = allocate(size);
+    if(p == 0) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void * operator new[](std::size_t size) STORM_THROW_BAD_ALLOC {
+    return operator new(size);
+}
+
+void * operator new(std::size_t size, const std::nothrow_t&) STORM_NO_THROW {
+    return allocate(size);
+}
+
+void * operator new[](std::size_t size, const std::nothrow_t&) STORM_NO_THROW {
+    return allocate(size);
+}
+
+void operator delete(void * p) STORM_NO_THROW {
+    std::free(p);
+}
+
+void operator delete[](void * p) STORM_NO_THROW {
+    std::free(p);
+}
+
+void operator delete(void * p, const std::nothrow_t&) STORM_NO_THROW {
+    std::free(p);
+}
+
+void operator delete[](void * p, const std::nothrow_t&) STORM_NO_THROW {
+    std::free(p);
+}
@@ -0,0 +1,56 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+/*
+ * Number of heap allocations of the process
+ *
+ * Used to verify that the localization of a frame does not allocate
+ * any memory once the workspace has grown to the frame. Allocations are
+ * only counted in builds with STORM_COUNT_ALLOCATIONS (cmake option
+ * of the same name). In those builds, allocationcounter.cpp replaces
+ * the global operator new and FrameWorkspace counts its fftwf_malloc()
+ * buffers. Otherwise allocationCount() is always 0.
+ */
+
+#ifdef STORM_COUNT_ALLOCATIONS
+void countAllocation();
+unsigned long allocationCount();
+#else
+inline void countAllocation() {  }
+inline unsigned long allocationCount() { return 0; }
+#endif // STORM_COUNT_ALLOCATIONS
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,379 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef BACKGROUNDFILTER_H
+#define BACKGROUNDFILTER_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vigra/error.hxx>
+#include "cpudispatch.hxx"
+#include "localmaxima.hxx"
+#ifdef OPENMP_FOUND
+    #include <omp.h>
+#endif //OPENMP_FOUND
+
+/*
+ * Background estimation with a first order recursive (exponential)
+ * smoothing filter, subtraction of the background and its minimum
+ * in one pass over the frame.
+ *
+ * This gives the same result as
+ *   vigra::recursiveSmoothX(srcImageRange(im), destImage(bg), scale);
+ *   vigra::recursiveSmoothY(srcImageRange(bg), destImage(bg), scale);
+ *   im -= bg;
+ * i.e. vigra::recursiveFilterLine() with BORDER_TREATMENT_REPEAT and 
+ * the same rounding of every intermediate result.
+ *
+ * vigra filters one line after another, so the Y pass walks down the 
+ * columns of the frame with a stride of the image width. Here the 
+ * recurrence runs on a block of columns at once: every step of the
+ * recursion is a loop over contiguous pixels that the compiler can 
+ * vectorize. For the X pass, strips of rows are transposed into a 
+ * small buffer and filtered the same way. The subtraction and the 
+ * minimum of the background are done in the backward Y pass, while
+ * the pixels are still in cache.
+ *
+ * The strips and blocks are independent, so they can be distributed
+ * over several threads (setThreads()) without changing the result.
+ * The loops over the strips and blocks are compiled for each CpuPath.
+ *
+ * subtract() can also take over the remaining passes over the frame
+ * that follow the inverse FFT: the normalization of the transform is
+ * applied in the X pass, and the local maxima are searched in the 
+ * backward Y pass, as soon as three rows of a block are final. Only
+ * the two columns at each seam between blocks are searched afterwards.
+ *
+ * The images must be stored contiguously (e.g. BasicImage or 
+ * BasicImageView).
+ */
+
+template <class T>
+class BackgroundFilter {
+public:
+    typedef T value_type;
+
+    BackgroundFilter(const double scale=10.); // todo: estimate scale from data
+
+    /**
+     * Smooth im to bg and subtract bg from im.
+     *
+     * @return minimum of bg
+     */
+    template <class Image>
+    T subtract(Image& im, Image& bg);
+
+    /**
+     * Same as above, but im is multiplied by normalization first and
+     * the local maxima of the result above threshold are written to 
+     * maxima (as offsets y*width+x in row-major order, the same as
+     * localMaximaIndices() on the whole image).
+     */
+    template <class Image>
+    T subtract(Image& im, Image& bg, const T normalization, 
+                const T threshold, std::vector<int>& maxima);
+
+    double scale() const { return m_scale; }
+
+    /**
+     * Number of threads that filter one image (default: 1)
+     */
+    void setThreads(const int threads) { m_threads = std::max(1, threads); }
+    int threads() const { return m_threads; }
+
+private:
+    enum { STRIP = 16, BLOCK = 64 }; // rows per X strip, columns per Y block
+
+    void filterRows(T * src, T * dest, const int w, const int h, const T normalization);
+    T filterColumns(T * im, T * bg, const int w, const int h, 
+                const bool findMaxima, const T threshold);
+
+    // strip i of filterRows(), block i of filterColumns() and their variants
+    void filterStrip(T * src, T * dest, const int w, const int h, 
+                const T normalization, const int i);
+    STORM_TARGET_AVX2 void filterStripAVX2(T * src, T * dest, const int w, const int h, 
+                const T normalization, const int i) {
+        filterStrip(src, dest, w, h, normalization, i);
+    }
+    STORM_TARGET_AVX512 void filterStripAVX512(T * src, T * dest, const int w, const int h, 
+                const T normalization, const int i) {
+        filterStrip(src, dest, w, h, normalization, i);
+    }
+    void filterBlock(T * im, T * bg, const int w, const int h, 
+                const bool findMaxima, const T threshold, const int i);
+    STORM_TARGET_AVX2 void filterBlockAVX2(T * im, T * bg, const int w, const int h, 
+                const bool findMaxima, const T threshold, const int i) {
+        filterBlock(im, bg, w, h, findMaxima, threshold, i);
+    }
+    STORM_TARGET_AVX512 void filterBlockAVX512(T * im, T * bg, const int w, const int h, 
+                const bool findMaxima, const T threshold, const int i) {
+        filterBlock(im, bg, w, h, findMaxima, threshold, i);
+    }
+    void collectMaxima(const T * im, const int w, const int h, 
+                const T threshold, std::vector<int>& maxima);
+
+    // index of the calling thread within filterRows() or filterColumns()
+    static int threadIndex() {
+        #ifdef OPENMP_FOUND
+        return omp_get_thread_num();
+        #else
+        return 0;
+        #endif //OPENMP_FOUND
+    }
+
+    double m_scale;
+    double m_b, m_norm, m_init; // filter coefficient, normalization, border
+    int m_threads;
+    std::vector<T> m_tile, m_line; // one part per thread
+    std::vector<T> m_minima;       // per block
+    std::vector<std::vector<int> > m_maxima; // per block, and the seams
+};
+
+template <class T>
+BackgroundFilter<T>::BackgroundFilter(const double scale) 
+    : m_scale(scale), m_threads(1) {
+    vigra_precondition(scale >= 0, "BackgroundFilter: scale must be >= 0.");
+    m_b = (scale == 0.0) ? 0.0 : std::exp(-1.0/scale);
+    m_norm = (1.0 - m_b) / (1.0 + m_b);
+    m_init = 1.0 / (1.0 - m_b);
+}
+
+template <class T>
+template <class Image>
+T BackgroundFilter<T>::subtract(Image& im, Image& bg) {
+    const int w = im.width();
+    const int h = im.height();
+    vigra_precondition(w > 0 && h > 0 && bg.width() == w && bg.height() == h,
+        "BackgroundFilter::subtract(): images must have the same, non-zero size.");
+    filterRows(im.data(), bg.data(), w, h, T(1));
+    return filterColumns(im.data(), bg.data(), w, h, false, T());
+}
+
+template <class T>
+template <class Image>
+T BackgroundFilter<T>::subtract(Image& im, Image& bg, const T normalization, 
+            const T threshold, std::vector<int>& maxima) {
+    const int w = im.width();
+    const int h = im.height();
+    vigra_precondition(w > 0 && h > 0 && bg.width() == w && bg.height() == h,
+        "BackgroundFilter::subtract(): images must have the same, non-zero size.");
+    filterRows(im.data(), bg.data(), w, h, normalization);
+    T minimum = filterColumns(im.data(), bg.data(), w, h, true, threshold);
+    collectMaxima(im.data(), w, h, threshold, maxima);
+    return minimum;
+}
+
+/**
+ * src *= normalization, 
+ * dest = recursive filter of src along x, STRIP rows at a time
+ */
+template <class T>
+void BackgroundFilter<T>::filterRows(T * src, T * dest, const int w, const int h, 
+            const T normalization) {
+    m_tile.resize(m_threads*w*STRIP);
+    m_line.resize(m_threads*w*STRIP);
+    const int strips = (h+STRIP-1)/STRIP;
+    const CpuPath path = kernelPath(CPU_AVX512);
+    #pragma omp parallel for num_threads(m_threads) if(m_threads > 1) schedule(static)
+    for(int i = 0; i < strips; ++i) {
+        if(path == CPU_AVX512) {
+            filterStripAVX512(src, dest, w, h, normalization, i);
+        } else if(path == CPU_AVX2) {
+            filterStripAVX2(src, dest, w, h, normalization, i);
+        } else {
+            filterStrip(src, dest, w, h, normalization, i);
+        }
+    }
+}
+
+template <class T>
+STORM_ALWAYS_INLINE void BackgroundFilter<T>::filterStrip(T * src, T * dest, const int w, const int h, 
+            const T normalization, const int i) {
+    const double b = m_b;
+    const int y0 = i*STRIP;
+    const int n = std::min((int)STRIP, h-y0);
+    T * tile = &m_tile[threadIndex()*w*STRIP];
+    T * line = &m_line[threadIndex()*w*STRIP];
+    T old[STRIP];
+    // transpose: tile[x*STRIP+r] = src(x, y0+r)
+    for(int r = 0; r < n; ++r) {
+        T * s = src + (y0+r)*w;
+        if(normalization != T(1)) {
+            for(int x = 0; x < w; ++x) {
+                s[x] = T(s[x] * normalization);
+            }
+        }
+        for(int x = 0; x < w; ++x) {
+            tile[x*STRIP+r] = s[x];
+        }
+    }
+
+    // causal part
+    for(int r = 0; r < n; ++r) {
+        old[r] = T(m_init * tile[r]);
+    }
+    for(int x = 0; x < w; ++x) {
+        for(int r = 0; r < n; ++r) {
+            old[r] = T(tile[x*STRIP+r] + b * old[r]);
+            line[x*STRIP+r] = old[r];
+        }
+    }
+    // anti-causal part, the result replaces the causal part
+    for(int r = 0; r < n; ++r) {
+        old[r] = T(m_init * tile[(w-1)*STRIP+r]);
+    }
+    for(int x = w-1; x >= 0; --x) {
+        for(int r = 0; r < n; ++r) {
+            T f = T(b * old[r]);
+            old[r] = tile[x*STRIP+r] + f;
+            line[x*STRIP+r] = T(m_norm * (line[x*STRIP+r] + f));
+        }
+    }
+
+    // transpose back
+    for(int r = 0; r < n; ++r) {
+        T * d = dest + (y0+r)*w;
+        for(int x = 0; x < w; ++x) {
+            d[x] = line[x*STRIP+r];
+        }
+    }
+}
+
+/**
+ * bg = recursive filter of bg along y, im -= bg, BLOCK columns at a time.
+ * If findMaxima is set, the maxima inside each block are written to m_maxima.
+ */
+template <class T>
+T BackgroundFilter<T>::filterColumns(T * im, T * bg, const int w, const int h, 
+            const bool findMaxima, const T threshold) {
+    m_line.resize(m_threads*h*BLOCK);
+    const int blocks = (w+BLOCK-1)/BLOCK;
+    m_minima.resize(blocks);
+    m_maxima.resize(blocks+1);
+    const CpuPath path = kernelPath(CPU_AVX512);
+    #pragma omp parallel for num_threads(m_threads) if(m_threads > 1) schedule(static)
+    for(int i = 0; i < blocks; ++i) {
+        if(path == CPU_AVX512) {
+            filterBlockAVX512(im, bg, w, h, findMaxima, threshold, i);
+        } else if(path == CPU_AVX2) {
+            filterBlockAVX2(im, bg, w, h, findMaxima, threshold, i);
+        } else {
+            filterBlock(im, bg, w, h, findMaxima, threshold, i);
+        }
+    }
+    return *std::min_element(m_minima.begin(), m_minima.end());
+}
+
+template <class T>
+STORM_ALWAYS_INLINE void BackgroundFilter<T>::filterBlock(T * im, T * bg, const int w, const int h, 
+            const bool findMaxima, const T threshold, const int i) {
+    const double b = m_b;
+    const int x0 = i*BLOCK;
+    const int n = std::min((int)BLOCK, w-x0);
+    T * line = &m_line[threadIndex()*h*BLOCK];
+    T old[BLOCK];
+    T minimum = std::numeric_limits<T>::max();
+    int rowMaxima[BLOCK];
+    std::vector<int> & maxima = m_maxima[i];
+    maxima.clear();
+
+    // causal part
+    const T * first = bg + x0;
+    for(int c = 0; c < n; ++c) {
+        old[c] = T(m_init * first[c]);
+    }
+    for(int y = 0; y < h; ++y) {
+        const T * s = bg + y*w + x0;
+        for(int c = 0; c < n; ++c) {
+            old[c] = T(s[c] + b * old[c]);
+            line[y*BLOCK+c] = old[c];
+        }
+    }
+    // anti-causal part and subtraction
+    const T * last = bg + (h-1)*w + x0;
+    for(int c = 0; c < n; ++c) {
+        old[c] = T(m_init * last[c]);
+    }
+    for(int y = h-1; y >= 0; --y) {
+        T * s = bg + y*w + x0;
+        T * d = im + y*w + x0;
+        for(int c = 0; c < n; ++c) {
+            T f = T(b * old[c]);
+            old[c] = s[c] + f;
+            T v = T(m_norm * (line[y*BLOCK+c] + f));
+            s[c] = v;
+            d[c] = d[c] - v;
+            minimum = std::min(minimum, v);
+        }
+        // rows y to h-1 are final: search row y+1 inside the block
+        if(findMaxima && y+2 < h && n > 2) {
+            const int k = localMaximaIndices(im + y*w + x0, w, n, 3, threshold, rowMaxima);
+            for(int j = 0; j < k; ++j) {
+                maxima.push_back(y*w + x0 + rowMaxima[j]);
+            }
+        }
+    }
+    m_minima[i] = minimum;
+}
+
+/**
+ * Search the columns at the seams between the blocks (the last and
+ * the first column of neighbouring blocks) and sort the maxima of 
+ * all blocks into row-major order.
+ */
+template <class T>
+void BackgroundFilter<T>::collectMaxima(const T * im, const int w, const int h, 
+            const T threshold, std::vector<int>& maxima) {
+    const int blocks = (w+BLOCK-1)/BLOCK;
+    std::vector<int> & seams = m_maxima[blocks];
+    int n = 0;
+    for(int i = 1; i < blocks; ++i) {
+        const int x0 = i*BLOCK-2;
+        seams.resize(n+2*h);
+        const int k = localMaximaIndices(im + x0, w, std::min(4, w-x0), h, threshold, &seams[n]);
+        for(int j = n; j < n+k; ++j) {
+            seams[j] += x0;
+        }
+        n += k;
+    }
+    seams.resize(n);
+    maxima.clear();
+    for(int i = 0; i <= blocks; ++i) {
+        maxima.insert(maxima.end(), m_maxima[i].begin(), m_maxima[i].end());
+    }
+    std::sort(maxima.begin(), maxima.end());
+}
+
+#endif // BACKGROUNDFILTER_H
@@ -0,0 +1,130 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher and Ullrich Koethe      */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/************************************************************************/
+
+// Compare runtime and results of the localization methods on a dataset.
+// Usage: stormbench [storm options] infile.sif
+// All localization methods are run with the given options (factor,
+// threshold, frames, ...). The spline method is used as reference.
+
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <cmath>
+#include "program_options_getopt.h"
+#include "wienerStorm.hxx"
+#include "myimportinfo.h"
+
+#include <vigra/timing.hxx>
+
+/**
+ * Count the spots of the test result that have a reference spot within
+ * one pixel and accumulate their distance (in pixels).
+ */
+template <class C>
+int compareCoords(const std::vector<std::vector<C> >& ref, const std::vector<std::vector<C> >& test,
+            const int factor, double& sumDist) {
+    int matched = 0;
+    sumDist = 0.;
+    for(unsigned int j = 0; j < test.size(); ++j) {
+        typename std::vector<C>::const_iterator it, itr;
+        for(it = test[j].begin(); it != test[j].end(); ++it) {
+            double best = factor; // only accept matches closer than 1px
+            for(itr = ref[j].begin(); itr != ref[j].end(); ++itr) {
+                double dx = (double)it->x - itr->x;
+                double dy = (double)it->y - itr->y;
+                double d = std::sqrt(dx*dx+dy*dy);
+                if(d < best) {
+                    best = d;
+                }
+            }
+            if(best < factor) {
+                ++matched;
+                sumDist += best/factor;
+            }
+        }
+    }
+    return matched;
+}
+
+template <class C>
+int countCoords(const std::vector<std::vector<C> >& coords) {
+    int n = 0;
+    for(unsigned int j = 0; j < coords.size(); ++j) {
+        n += coords[j].size();
+    }
+    return n;
+}
+
+// MAIN
+int main(int argc, char** argv) {
+    std::map<char, double> params;
+    std::map<char, std::string> files;
+    if(parseProgramOptions(argc, argv, params, files)!=0) {
+        return -1;
+    }
+    int factor = (int)params['g'];
+    int roilen = (int)params['m'];
+    float threshold = params['t'];
+    std::string infile = files['i'];
+    std::string filterfile = files['f'];
+    std::string frames = files['F'];
+
+    const LocalizationMethod methods[] = { SPLINE_UPSAMPLING, FOURIER_UPSAMPLING, NEWTON_REFINEMENT, MLE_FIT, PEAK_UPSAMPLING, QUICKLOOK_DETECTION };
+    const int numMethods = sizeof(methods)/sizeof(methods[0]);
+
+    try
+    {
+        MyImportInfo info(infile);
+        int stacksize = info.shape()[2];
+        BasicImage<float> filter(info.shapeOfDimension(0), info.shapeOfDimension(1));
+        generateFilter(info, filter, filterfile);
+        const float psfWidth = estimatePSFWidth(filter);
+
+        std::vector<std::vector<Coord<float> > > reference;
+        USETICTOC;
+        for(int m = 0; m < numMethods; ++m) {
+            StormOptions options;
+            options.method = methods[m];
+            options.psfWidth = psfWidth;
+            options.tileSize = (int)params['T'];
+            std::vector<std::vector<Coord<float> > > coords(stacksize);
+
+            TIC;
+            wienerStorm(info, filter, coords, threshold, factor, roilen, frames, 0, options);
+            double ms = TOCN;
+
+            int numSpots = countCoords(coords);
+            std::cout << std::setw(10) << localizationMethodName(methods[m]) << ": "
+                << std::fixed << std::setprecision(1) << ms << " ms, "
+                << numSpots << " spots";
+            if(numSpots > 0) {
+                std::cout << ", " << std::setprecision(2) << 1000.*ms/numSpots << " us/spot";
+            }
+            if(m == 0) {
+                reference = coords;
+            } else {
+                double sumDist = 0.;
+                int matched = compareCoords(reference, coords, factor, sumDist);
+                std::cout << ", " << matched << " matched to " << localizationMethodName(methods[0]);
+                if(matched > 0) {
+                    std::cout << " (mean distance " << std::setprecision(3) << sumDist/matched << " px)";
+                }
+            }
+            std::cout << std::endl;
+        }
+    }
+    catch (vigra::StdException & e)
+    {
+        std::cout<<"There was an error:"<<std::endl;
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
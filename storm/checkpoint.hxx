@@ -0,0 +1,178 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstddef>
+#include <ios>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Checkpoints of a long run, to resume it after the process was killed
+ *
+ * The spots are written frame by frame in the order of the stack (see 
+ * StreamingCoordsWriter), and the localization of a frame does not
+ * depend on the others. What was written up to a frame is therefore 
+ * a prefix of the complete output. A checkpoint records the frames 
+ * that are complete, the length of the coordinate file and the number
+ * of spots at that point, the result image (the sum of the spots so 
+ * far) and a fingerprint of the filter and the parameters of the run.
+ * A resumed run cuts the coordinate file to the recorded length (the
+ * killed run may have written more), continues it and the image from 
+ * the recorded sum, so that the output is identical to an 
+ * uninterrupted run.
+ *
+ * A checkpoint is written to a temporary file that replaces the last
+ * checkpoint when it is complete.
+ */
+
+/**
+ * FNV-1a hash over the filter and the parameters of a run
+ */
+class Fingerprint {
+public:
+    Fingerprint() : m_hash(2166136261u) {  }
+    void add(const void * data, const std::size_t size) {
+        const unsigned char * p = (const unsigned char *)data;
+        for(std::size_t k = 0; k < size; ++k) {
+            m_hash = (m_hash ^ p[k]) * 16777619u;
+        }
+    }
+    void add(const std::string& s) { add(s.data(), s.size()); }
+    void add(const int v) { add(&v, sizeof(v)); }
+    void add(const float v) { add(&v, sizeof(v)); }
+    template <class Image>
+    void addImage(const Image& im) {
+        add(im.width());
+        add(im.height());
+        add(im.data(), sizeof(typename Image::value_type)*im.width()*im.height());
+    }
+    unsigned int value() const { return m_hash; }
+private:
+    unsigned int m_hash;
+};
+
+/**
+ * State of a run after the frames before done
+ */
+class Checkpoint {
+public:
+    Checkpoint() : done(0), numSpots(0), coordsBytes(0), fingerprint(0) {  }
+    int done;                 // all frames < done are complete
+    int numSpots;             // spots in these frames
+    std::streamoff coordsBytes; // length of the coordinate file
+    unsigned int fingerprint;
+};
+
+/**
+ * Write a checkpoint with the result image res. 
+ * Returns false if the file could not be written.
+ */
+template <class Image>
+bool saveCheckpoint(const std::string& filename, const Checkpoint& cp, const Image& res) {
+    const std::string tmpfile = filename + ".tmp";
+    {
+        std::ofstream f(tmpfile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        f << "storm-checkpoint 1\n" 
+          << std::hex << cp.fingerprint << std::dec << " " << cp.done << " " << cp.numSpots << " " 
+          << cp.coordsBytes << " " << res.width() << " " << res.height() << "\n";
+        f.write((const char *)res.data(), sizeof(typename Image::value_type)*res.width()*res.height());
+        if(!f) {
+            f.close();
+            std::remove(tmpfile.c_str());
+            return false;
+        }
+    }
+    if(std::rename(tmpfile.c_str(), filename.c_str()) != 0) {
+        // Windows does not replace existing files
+        std::remove(filename.c_str());
+        return std::rename(tmpfile.c_str(), filename.c_str()) == 0;
+    }
+    return true;
+}
+
+/**
+ * Read a checkpoint, res must have the size of the image in the checkpoint.
+ * Returns false if the file could not be read or does not match.
+ */
+template <class Image>
+bool loadCheckpoint(const std::string& filename, Checkpoint& cp, Image& res) {
+    std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+    std::string magic;
+    int version = 0, w = 0, h = 0;
+    f >> magic >> version;
+    if(!f || magic != "storm-checkpoint" || version != 1) {
+        return false;
+    }
+    f >> std::hex >> cp.fingerprint >> std::dec >> cp.done >> cp.numSpots >> cp.coordsBytes >> w >> h;
+    if(!f || w != res.width() || h != res.height()) {
+        return false;
+    }
+    f.get(); // end of line
+    f.read((char *)res.data(), sizeof(typename Image::value_type)*res.width()*res.height());
+    return !f.fail();
+}
+
+/**
+ * Cut a file to its first size bytes. The bytes are copied to a 
+ * temporary file that replaces it (there is no portable truncate).
+ * Returns false if the file could not be read or is shorter.
+ */
+inline bool truncateFile(const std::string& filename, const std::streamoff size) {
+    const std::string tmpfile = filename + ".tmp";
+    {
+        std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+        std::ofstream out(tmpfile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        std::vector<char> buffer(1 << 16);
+        for(std::streamoff left = size; left > 0 && in && out; ) {
+            const std::streamsize n = (std::streamsize)std::min(left, (std::streamoff)buffer.size());
+            in.read(&buffer[0], n);
+            out.write(&buffer[0], in.gcount());
+            left -= in.gcount();
+        }
+        if(!in || !out) {
+            out.close();
+            std::remove(tmpfile.c_str());
+            return false;
+        }
+    }
+    std::remove(filename.c_str()); // Windows does not replace existing files
+    return std::rename(tmpfile.c_str(), filename.c_str()) == 0;
+}
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,177 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+#ifndef CPUDISPATCH_H
+#define CPUDISPATCH_H
+
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+
+/*
+ * Runtime selection of the instruction set for the hot kernels
+ *
+ * The binary is built for the baseline of the architecture (SSE2 on 
+ * x86-64), so that it runs on every machine. The hot kernels are
+ * additionally compiled for AVX2 and AVX-512 with the target attribute
+ * of GCC and clang: A variant is a thin wrapper with STORM_TARGET_AVX2
+ * (or STORM_TARGET_AVX512) around the generic code, which is forced
+ * inline (STORM_ALWAYS_INLINE) and thus compiled for the wider units.
+ * Which variant runs is decided once per process by cpuPath().
+ *
+ * AVX-512 implies FMA, but the build disables the contraction of 
+ * multiplies and adds (-ffp-contract=off) and the compiler does not 
+ * reorder floating point operations, so all variants give identical 
+ * results (checked by the tests with STORM_CPU_PATH).
+ * Other compilers (e.g. MSVC) only get the generic variant.
+ *
+ * The environment variable STORM_CPU_PATH (generic, avx2 or avx512)
+ * limits the path, e.g. to compare the variants on one machine.
+ */
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+    #define STORM_MULTIVERSIONING
+    #define STORM_TARGET_AVX2 __attribute__((target("avx2")))
+    #define STORM_TARGET_AVX512 __attribute__((target("avx512f")))
+    #define STORM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+    #define STORM_TARGET_AVX2
+    #define STORM_TARGET_AVX512
+    #ifdef _MSC_VER
+        #define STORM_ALWAYS_INLINE __forceinline
+    #else
+        #define STORM_ALWAYS_INLINE inline
+    #endif
+#endif
+
+enum CpuPath {
+    CPU_GENERIC, // baseline of the build
+    CPU_AVX2,
+    CPU_AVX512
+};
+
+inline const char * cpuPathName(const CpuPath path) {
+    switch(path) {
+        case CPU_AVX512:
+            return "avx512";
+        case CPU_AVX2:
+            return "avx2";
+        case CPU_GENERIC:
+        default:
+            return "generic";
+    }
+}
+
+/**
+ * Widest instruction set that the CPU (and the operating system) supports
+ */
+inline CpuPath detectCpuPath() {
+#ifdef STORM_MULTIVERSIONING
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) {
+        return CPU_AVX512;
+    }
+    if(__builtin_cpu_supports("avx2")) {
+        return CPU_AVX2;
+    }
+#endif // STORM_MULTIVERSIONING
+    return CPU_GENERIC;
+}
+
+/**
+ * Path requested by STORM_CPU_PATH, limited to the detected one
+ */
+inline CpuPath limitCpuPath(const CpuPath detected) {
+    const char * env = std::getenv("STORM_CPU_PATH");
+    CpuPath requested = detected;
+    if(env == 0) {
+        return detected;
+    } else if(std::strcmp(env, "generic") == 0) {
+        requested = CPU_GENERIC;
+    } else if(std::strcmp(env, "avx2") == 0) {
+        requested = CPU_AVX2;
+    }
+    return (requested < detected) ? requested : detected;
+}
+
+/**
+ * Path of the kernels in this process: the detected one, 
+ * limited by STORM_CPU_PATH if set
+ */
+inline CpuPath cpuPath() {
+    static const CpuPath path = limitCpuPath(detectCpuPath());
+    return path;
+}
+
+/**
+ * Path of a kernel that has variants up to best
+ */
+inline CpuPath kernelPath(const CpuPath best) {
+    return (cpuPath() < best) ? cpuPath() : best;
+}
+
+/**
+ * The dispatched kernels and their widest variant
+ */
+enum { NUM_DISPATCHED_KERNELS = 5 };
+inline const char * dispatchedKernelName(const int k) {
+    static const char * names[NUM_DISPATCHED_KERNELS] = { 
+        "spectrum multiply", "background filter", "local maxima", 
+        "spline upsampling", "asymmetry" };
+    return names[k];
+}
+inline CpuPath dispatchedKernelBest(const int k) {
+    static const CpuPath best[NUM_DISPATCHED_KERNELS] = { 
+        CPU_AVX512, CPU_AVX512, CPU_AVX512, CPU_AVX512, CPU_AVX512 };
+    return best[k];
+}
+
+/**
+ * Report the detected path and the variant of every kernel
+ */
+inline void printCpuPath(std::ostream& os) {
+    os << "cpu: " << cpuPathName(detectCpuPath());
+#ifndef STORM_MULTIVERSIONING
+    os << " (built without multiversioning)";
+#endif // STORM_MULTIVERSIONING
+    if(cpuPath() != detectCpuPath()) {
+        os << ", limited to " << cpuPathName(cpuPath()) << " by STORM_CPU_PATH";
+    }
+    os << std::endl;
+    for(int k = 0; k < NUM_DISPATCHED_KERNELS; ++k) {
+        os << "  " << dispatchedKernelName(k) << ": " 
+           << cpuPathName(kernelPath(dispatchedKernelBest(k))) << std::endl;
+    }
+}
+
+#endif // CPUDISPATCH_H
@@ -36,6 +36,8 @@
 #include <vigra/basicimage.hxx>
 #include <vigra/basicimageview.hxx>
 #include <vigra/fftw3.hxx>
+#include <cmath>
+#include "cpudispatch.hxx"
 
 /*
  * Encapsulate filtering in fourier domain 
@@ -49,6 +51,13 @@
  * Essentially this is a rewritten thread-safe version of 
  * vigra::applyFourierFilter for real-valued floating point images.
  * See there for usage examples.
+ *
+ * If FFTW was built with thread support (FFTW_THREADS), the plans can
+ * use several threads per transform (nthreads), e.g. for large frames
+ * that are not processed in parallel otherwise.
+ *
+ * The multiplication with a real-valued filter image is run in the 
+ * variant for the CpuPath of the machine.
  */
 
 using namespace vigra; // for now
@@ -63,12 +72,14 @@ template <> // currently only float supported!!
 class FFTFilter<float> {
 public:
     typedef float value_type;
+    typedef vigra::BasicImageView<vigra::FFTWComplex<value_type> > ComplexImageView;
 
     template <class SrcImageIterator, class SrcAccessor>
     FFTFilter(SrcImageIterator srcUpperLeft,
-                            SrcImageIterator srcLowerRight, SrcAccessor sa);
+                            SrcImageIterator srcLowerRight, SrcAccessor sa,
+                            const int nthreads=1);
     template <class SrcImageIterator, class SrcAccessor>
-    FFTFilter(triple<SrcImageIterator, SrcImageIterator, SrcAccessor>);
+    FFTFilter(triple<SrcImageIterator, SrcImageIterator, SrcAccessor>, const int nthreads=1);
     ~FFTFilter() {    
         fftwf_destroy_plan(forwardPlan);
         fftwf_destroy_plan(backwardPlan); 
@@ -87,11 +98,58 @@ public:
     void applyFourierFilter(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
                         pair<FilterImageIterator, FilterAccessor> filter,
                         pair<DestImageIterator, DestAccessor> dest) const;
+    // same as above, using a preallocated buffer of size (w/2+1) x h 
+    // for the spectrum (e.g. from a FrameWorkspace). If normalize is false,
+    // the result still has to be multiplied by normalization(), e.g. 
+    // in a later pass over the image.
+    template <class SrcImageIterator, class SrcAccessor,
+          class FilterImageIterator, class FilterAccessor,
+          class DestImageIterator, class DestAccessor>
+    void applyFourierFilter(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                        pair<FilterImageIterator, FilterAccessor> filter,
+                        pair<DestImageIterator, DestAccessor> dest,
+                        ComplexImageView & complexImg, const bool normalize=true) const;
+
+    // factor of the inverse transform, 1/(w*h)
+    value_type normalization() const { return normFactor; }
 
 private:
+    template <class SrcImageIterator, class SrcAccessor,
+          class FilterImageIterator, class FilterAccessor>
+    void forwardTransform(SrcImageIterator srcUpperLeft, SrcAccessor sa,
+                        FilterImageIterator filterUpperLeft, FilterAccessor fa,
+                        ComplexImageView & complexImg) const;
+    template <class DestImageIterator, class DestAccessor>
+    void inverseTransform(ComplexImageView & complexImg,
+                        DestImageIterator destUpperLeft, DestAccessor da,
+                        const bool normalize=true) const;
+
+    // multiply the spectrum with the left half of the filter
+    template <class FilterImageIterator, class FilterAccessor>
+    void multiplySpectrum(FilterImageIterator filterUpperLeft, FilterAccessor fa,
+                        ComplexImageView & complexImg) const;
+    template <class FilterImageIterator>
+    void multiplySpectrum(FilterImageIterator filterUpperLeft, StandardValueAccessor<value_type>,
+                        ComplexImageView & complexImg) const;
+    template <class FilterImageIterator>
+    void multiplySpectrum(FilterImageIterator filterUpperLeft, StandardConstValueAccessor<value_type>,
+                        ComplexImageView & complexImg) const;
+    template <class FilterImageIterator>
+    void multiplySpectrumRows(FilterImageIterator filterUpperLeft, ComplexImageView & complexImg) const;
+    // one row of n complex numbers (interleaved), rounded like
+    // FFTWComplex::operator*=() with a filter value of imaginary part 0
+    static void multiplyRow(value_type * c, const value_type * f, const int n);
+    STORM_TARGET_AVX2 static void multiplyRowAVX2(value_type * c, const value_type * f, const int n) {
+        multiplyRow(c, f, n);
+    }
+    STORM_TARGET_AVX512 static void multiplyRowAVX512(value_type * c, const value_type * f, const int n) {
+        multiplyRow(c, f, n);
+    }
+
     template <class SrcImageIterator, class SrcAccessor>
     void init(SrcImageIterator srcUpperLeft,
-                            SrcImageIterator srcLowerRight, SrcAccessor sa);
+                            SrcImageIterator srcLowerRight, SrcAccessor sa,
+                            const int nthreads);
     fftwf_plan forwardPlan;
     fftwf_plan backwardPlan;
     int w,h;
@@ -103,18 +161,24 @@ private:
 // NOT THREAD-SAFE!
 template <class SrcImageIterator, class SrcAccessor>
 FFTFilter<float>::FFTFilter(SrcImageIterator srcUpperLeft,
-                            SrcImageIterator srcLowerRight, SrcAccessor sa) {
-    init(srcUpperLeft, srcLowerRight, sa);
+                            SrcImageIterator srcLowerRight, SrcAccessor sa,
+                            const int nthreads) {
+    init(srcUpperLeft, srcLowerRight, sa, nthreads);
 }
 
 template <class SrcImageIterator, class SrcAccessor>
 void FFTFilter<float>::init(SrcImageIterator srcUpperLeft,
-                            SrcImageIterator srcLowerRight, SrcAccessor sa) {
+                            SrcImageIterator srcLowerRight, SrcAccessor sa,
+                            const int nthreads) {
     w= srcLowerRight.x - srcUpperLeft.x;
     h= srcLowerRight.y - srcUpperLeft.y;
     normFactor = 1. / (w*h);
     vigra::BasicImage<vigra::FFTWComplex<value_type> > complexImg(w/2+1,h);
     vigra::BasicImage<value_type> resultImg(w,h);
+#ifdef FFTW_THREADS
+    static bool threadsInitialized = (fftwf_init_threads() != 0);
+    fftwf_plan_with_nthreads(threadsInitialized ? nthreads : 1);
+#endif // FFTW_THREADS
     forwardPlan = fftwf_plan_dft_r2c_2d(h, w, (value_type *)&(*srcUpperLeft),
                            (fftwf_complex *)complexImg.begin(),
                            FFTW_ESTIMATE );
@@ -122,11 +186,15 @@ void FFTFilter<float>::init(SrcImageIterator srcUpperLeft,
     backwardPlan = fftwf_plan_dft_c2r_2d(h, w, (fftwf_complex *) complexImg.begin(),
                             (value_type *) resultImg.begin(), 
                             FFTW_ESTIMATE);
+#ifdef FFTW_THREADS
+    fftwf_plan_with_nthreads(1); // default for other plans
+#endif // FFTW_THREADS
 }
 
 template <class SrcImageIterator, class SrcAccessor>
-FFTFilter<float>::FFTFilter(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src) {
-    init(src.first, src.second, src.third);
+FFTFilter<float>::FFTFilter(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                            const int nthreads) {
+    init(src.first, src.second, src.third, nthreads);
 }
 
 
@@ -138,20 +206,107 @@ void FFTFilter<float>::applyFourierFilter (SrcImageIterator srcUpperLeft,
                             SrcImageIterator srcLowerRight, SrcAccessor sa,
                             FilterImageIterator filterUpperLeft, FilterAccessor fa,
                             DestImageIterator destUpperLeft, DestAccessor da) const {
+    vigra::BasicImage<vigra::FFTWComplex<value_type> > complexBuffer(w/2+1,h);
+    ComplexImageView complexImg(complexBuffer.data(), complexBuffer.size());
+    applyFourierFilter(srcIterRange(srcUpperLeft, srcLowerRight, sa),
+                       srcIter(filterUpperLeft, fa),
+                       destIter(destUpperLeft, da), complexImg);
+}
+
+template <class SrcImageIterator, class SrcAccessor,
+          class FilterImageIterator, class FilterAccessor,
+          class DestImageIterator, class DestAccessor>
+void FFTFilter<float>::applyFourierFilter(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                        pair<FilterImageIterator, FilterAccessor> filter,
+                        pair<DestImageIterator, DestAccessor> dest,
+                        ComplexImageView & complexImg, const bool normalize) const {
+    forwardTransform(src.first, src.third, filter.first, filter.second, complexImg);
+    inverseTransform(complexImg, dest.first, dest.second, normalize);
+}
+
+// forward transform and multiplication with the filter
+template <class SrcImageIterator, class SrcAccessor,
+          class FilterImageIterator, class FilterAccessor>
+void FFTFilter<float>::forwardTransform(SrcImageIterator srcUpperLeft, SrcAccessor sa,
+                        FilterImageIterator filterUpperLeft, FilterAccessor fa,
+                        ComplexImageView & complexImg) const {
     // test for correct memory layout (fftw expects a 2*width*height floats array)
     vigra_precondition (&(*(srcUpperLeft + Diff2D(w, 0))) == &(*(srcUpperLeft + Diff2D(0, 1))),
         "wrong memory layout of input data");
+    vigra_precondition (complexImg.width() == w/2+1 && complexImg.height() == h,
+        "wrong size of the complex buffer");
 
-    vigra::BasicImage<vigra::FFTWComplex<value_type> > complexImg(w/2+1,h);
     fftwf_execute_dft_r2c(
           forwardPlan,
           (value_type *)&(*srcUpperLeft), (fftwf_complex *)complexImg.begin());
     // convolve in freq. domain (in complexImg), only the left half of filter is used due to symmetry
+    multiplySpectrum(filterUpperLeft, fa, complexImg);
+}
+
+template <class FilterImageIterator, class FilterAccessor>
+void FFTFilter<float>::multiplySpectrum(FilterImageIterator filterUpperLeft, FilterAccessor fa,
+                        ComplexImageView & complexImg) const {
     combineTwoImages(srcImageRange(complexImg), srcIter(filterUpperLeft,fa),
                      destImage(complexImg), std::multiplies<vigra::FFTWComplex<value_type> >());
+}
+
+// float filter images (the usual case) are multiplied row by row
+template <class FilterImageIterator>
+inline
+void FFTFilter<float>::multiplySpectrum(FilterImageIterator filterUpperLeft, StandardValueAccessor<value_type>,
+                        ComplexImageView & complexImg) const {
+    multiplySpectrumRows(filterUpperLeft, complexImg);
+}
+
+template <class FilterImageIterator>
+inline
+void FFTFilter<float>::multiplySpectrum(FilterImageIterator filterUpperLeft, StandardConstValueAccessor<value_type>,
+                        ComplexImageView & complexImg) const {
+    multiplySpectrumRows(filterUpperLeft, complexImg);
+}
+
+template <class FilterImageIterator>
+void FFTFilter<float>::multiplySpectrumRows(FilterImageIterator filterUpperLeft, 
+                        ComplexImageView & complexImg) const {
+    const int n = complexImg.width();
+    const CpuPath path = kernelPath(CPU_AVX512);
+    for(int y = 0; y < h; ++y) {
+        value_type * c = (value_type *)&complexImg(0, y);
+        const value_type * f = &(*(filterUpperLeft + Diff2D(0, y)));
+        switch(path) {
+            case CPU_AVX512:
+                multiplyRowAVX512(c, f, n);
+                break;
+            case CPU_AVX2:
+                multiplyRowAVX2(c, f, n);
+                break;
+            default:
+                multiplyRow(c, f, n);
+        }
+    }
+}
+
+STORM_ALWAYS_INLINE
+void FFTFilter<float>::multiplyRow(value_type * c, const value_type * f, const int n) {
+    for(int x = 0; x < n; ++x) {
+        const value_type re = c[2*x];
+        const value_type im = c[2*x+1];
+        c[2*x] = re*f[x] - im*0.f;
+        c[2*x+1] = re*0.f + im*f[x];
+    }
+}
+
+// inverse transform and normalization. The content of complexImg is destroyed.
+template <class DestImageIterator, class DestAccessor>
+void FFTFilter<float>::inverseTransform(ComplexImageView & complexImg,
+                        DestImageIterator destUpperLeft, DestAccessor da,
+                        const bool normalize) const {
     fftwf_execute_dft_c2r(
             backwardPlan,
             (fftwf_complex *)complexImg.begin(), (value_type *)&(*destUpperLeft));
+    if(!normalize) {
+        return;
+    }
     transformImage(srcIterRange(destUpperLeft, destUpperLeft + Diff2D(w, h),da), 
             destIter(destUpperLeft,da), 
             vigra::functor::Arg1()*vigra::functor::Param(normFactor));
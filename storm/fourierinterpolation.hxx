@@ -0,0 +1,196 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+#ifndef FOURIERINTERPOLATION_H
+#define FOURIERINTERPOLATION_H
+
+#include <vector>
+#include <cmath>
+#include <vigra/error.hxx>
+#include <vigra/utilities.hxx>
+
+/*
+ * Band-limited (trigonometric) upsampling of small image regions
+ * by an integer factor.
+ *
+ * The Wiener-filtered frame contains no frequencies above the cutoff
+ * of the filter, so every ROI can be interpolated exactly by its
+ * discrete Fourier series. To avoid the discontinuity of a periodic
+ * continuation at the ROI borders, the ROI is extended symmetrically
+ * (period 2n-2), i.e. we interpolate with the DCT-I basis.
+ *
+ * Evaluating the series on the regular sub-pixel grid is a small DFT
+ * that is separable into two matrix products. The matrices only depend
+ * on the ROI length and the factor, so they are computed once, at the 
+ * first call of interpolate() (other methods never pay for them), and 
+ * the per-ROI cost is independent of any spline kernel.
+ */
+
+using namespace vigra; // for now
+
+template <class T>
+class FourierInterpolation {
+public:
+    typedef T value_type;
+
+    /**
+     * Interpolation of ROIs up to maxlen pixels. The matrices for all
+     * lengths are computed at the first call of interpolate().
+     */
+    FourierInterpolation(const int factor=1, const int maxlen=0)
+        : m_factor(factor), m_maxlen(maxlen) {  }
+
+    template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+    void interpolate(SrcImageIterator srcUpperLeft,
+                     SrcImageIterator srcLowerRight, SrcAccessor sa,
+                     DestImageIterator destUpperLeft,
+                     DestImageIterator destLowerRight, DestAccessor da);
+    template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+    void interpolate(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                     triple<DestImageIterator, DestImageIterator, DestAccessor> dest);
+
+    int factor() const { return m_factor; }
+
+private:
+    static double dirichletKernel(const double t, const int period);
+    void init();
+    const double * weights(const int len) const { return &m_weights[len][0]; }
+
+    int m_factor;
+    int m_maxlen;
+    // m_weights[n] is a (factor*(n-1)+1) x n matrix (row-major)
+    std::vector<std::vector<double> > m_weights;
+    std::vector<double> m_tmp;
+};
+
+
+/**
+ * Interpolation kernel of a real-valued trigonometric polynomial
+ * through 'period' equidistant samples (period is even here).
+ */
+template <class T>
+double FourierInterpolation<T>::dirichletKernel(const double t, const int period) {
+    double s = std::sin(M_PI*t/period);
+    if(std::fabs(s) < 1e-12) {
+        return 1.;
+    }
+    return std::sin(M_PI*t) * std::cos(M_PI*t/period) / (period*s);
+}
+
+template <class T>
+void FourierInterpolation<T>::init() {
+    const int factor = m_factor;
+    const int maxlen = m_maxlen;
+    m_weights.resize(maxlen+1);
+    m_tmp.reserve((factor*(maxlen-1)+1)*maxlen);
+    for(int n = 1; n <= maxlen; ++n) {
+        int n_xxl = factor*(n-1)+1;
+        std::vector<double> & w = m_weights[n];
+        w.resize(n_xxl*n);
+        if(n == 1) {
+            w[0] = 1.;
+            continue;
+        }
+        int period = 2*n-2; // symmetric extension of the ROI
+        for(int i = 0; i < n_xxl; ++i) {
+            double x = (double)i/factor;
+            w[i*n] = dirichletKernel(x, period);
+            w[i*n+n-1] = dirichletKernel(x-(n-1), period);
+            for(int k = 1; k < n-1; ++k) { // sample and its mirror image
+                w[i*n+k] = dirichletKernel(x-k, period) + dirichletKernel(x+k, period);
+            }
+        }
+    }
+}
+
+template <class T>
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+void FourierInterpolation<T>::interpolate(SrcImageIterator srcUpperLeft,
+                     SrcImageIterator srcLowerRight, SrcAccessor sa,
+                     DestImageIterator destUpperLeft,
+                     DestImageIterator destLowerRight, DestAccessor da) {
+    int w = srcLowerRight.x - srcUpperLeft.x;
+    int h = srcLowerRight.y - srcUpperLeft.y;
+    int w_xxl = destLowerRight.x - destUpperLeft.x;
+    int h_xxl = destLowerRight.y - destUpperLeft.y;
+    vigra_precondition(w <= m_maxlen && h <= m_maxlen,
+        "FourierInterpolation: ROI larger than precomputed length.");
+    vigra_precondition(w_xxl == m_factor*(w-1)+1 && h_xxl == m_factor*(h-1)+1,
+        "FourierInterpolation: destination must have size factor*(src-1)+1.");
+    if(m_weights.empty()) {
+        init();
+    }
+
+    // interpolate along x: tmp(x_xxl, y) = sum_k wx(x_xxl, k) * src(k, y)
+    const double * wx = weights(w);
+    m_tmp.resize(w_xxl*h);
+    SrcImageIterator sy = srcUpperLeft;
+    for(int y = 0; y < h; ++y, ++sy.y) {
+        for(int i = 0; i < w_xxl; ++i) {
+            double sum = 0.;
+            typename SrcImageIterator::row_iterator s = sy.rowIterator();
+            for(int k = 0; k < w; ++k, ++s) {
+                sum += wx[i*w+k] * sa(s);
+            }
+            m_tmp[y*w_xxl+i] = sum;
+        }
+    }
+
+    // interpolate along y
+    const double * wy = weights(h);
+    DestImageIterator dy = destUpperLeft;
+    for(int j = 0; j < h_xxl; ++j, ++dy.y) {
+        typename DestImageIterator::row_iterator d = dy.rowIterator();
+        for(int i = 0; i < w_xxl; ++i, ++d) {
+            double sum = 0.;
+            for(int l = 0; l < h; ++l) {
+                sum += wy[j*h+l] * m_tmp[l*w_xxl+i];
+            }
+            da.set(sum, d);
+        }
+    }
+}
+
+template <class T>
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+inline
+void FourierInterpolation<T>::interpolate(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                     triple<DestImageIterator, DestImageIterator, DestAccessor> dest) {
+    interpolate(src.first, src.second, src.third,
+                dest.first, dest.second, dest.third);
+}
+
+#endif // FOURIERINTERPOLATION_H
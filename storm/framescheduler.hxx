@@ -0,0 +1,499 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+#include <vigra/error.hxx>
+#ifdef OPENMP_FOUND
+    #include <omp.h>
+#endif //OPENMP_FOUND
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+/*
+ * Distribution of the frames of a stack to the threads
+ *
+ * A frame passes two stages: It is read into a buffer slot (in the
+ * order of the stack, by one thread at a time), and then filtered and
+ * localized by one thread. Between the stages, every thread has a 
+ * bounded queue of read frames. The queues are filled by whichever 
+ * thread finds its own queue short and the reader free, the shortest
+ * queue first. A thread takes its frames from the front of its own
+ * queue. If that is empty, it steals from the back of the longest queue
+ * of another thread, so that a thread with a run of dense frames does
+ * not hold up the others.
+ *
+ * The time per frame varies with the number of spots; the frames
+ * are therefore handed out one at a time instead of in static chunks.
+ *
+ * If there is no frame to take and no slot to read one into (all 
+ * slots hold frames in process or waiting to be written), a thread 
+ * sleeps until release() gives a slot back, with pauses growing from
+ * 20 us to 1 ms, instead of spinning on the locks.
+ *
+ * On machines with several NUMA nodes (see setNodes()), every node
+ * has its own pool of buffer slots, which are first written by a thread
+ * of that node (see slotOwner()). A frame is read into a slot of the
+ * node of the queue it is put in, and threads steal from the queues
+ * of their own node first.
+ * The scheduler counts per thread the frames, steals, reads and the
+ * time spent waiting for frames and reading, and samples the number
+ * of queued frames (see printMetrics()).
+ */
+
+using namespace vigra; // for now
+
+/**
+ * omp_lock_t, or nothing without OpenMP
+ */
+class SchedulerLock {
+public:
+    SchedulerLock() {
+        #ifdef OPENMP_FOUND
+        omp_init_lock(&m_lock);
+        #endif //OPENMP_FOUND
+    }
+    ~SchedulerLock() {
+        #ifdef OPENMP_FOUND
+        omp_destroy_lock(&m_lock);
+        #endif //OPENMP_FOUND
+    }
+    void set() {
+        #ifdef OPENMP_FOUND
+        omp_set_lock(&m_lock);
+        #endif //OPENMP_FOUND
+    }
+    void unset() {
+        #ifdef OPENMP_FOUND
+        omp_unset_lock(&m_lock);
+        #endif //OPENMP_FOUND
+    }
+    // set the lock if it is free, return false otherwise
+    bool test() {
+        #ifdef OPENMP_FOUND
+        return omp_test_lock(&m_lock) != 0;
+        #else
+        return true;
+        #endif //OPENMP_FOUND
+    }
+private:
+    // not copyable
+    SchedulerLock(const SchedulerLock&);
+    SchedulerLock& operator=(const SchedulerLock&);
+    #ifdef OPENMP_FOUND
+    omp_lock_t m_lock;
+    #endif //OPENMP_FOUND
+};
+
+/**
+ * Counters of one thread of a FrameScheduler
+ */
+class SchedulerMetrics {
+public:
+    SchedulerMetrics()
+        : frames(0), steals(0), remoteSteals(0), reads(0), idle(0.), reading(0.) {  }
+    int frames;     // frames processed
+    int steals;     // of these, taken from the queue of another thread
+    int remoteSteals; // of these, from a thread on another node
+    int reads;      // frames read (for all threads)
+    double idle;    // seconds waiting for a frame
+    double reading; // seconds reading
+};
+
+/**
+ * Reader for frames that are already in memory (nothing to read)
+ */
+class InMemoryFrames {
+public:
+    void operator()(const int /*frame*/, const int /*slot*/) {  }
+};
+
+class FrameScheduler {
+public:
+    /**
+     * Scheduler for threads calling next(), each with a queue of 
+     * up to depth read frames.
+     */
+    FrameScheduler(const int threads, const int depth=2);
+    ~FrameScheduler() {
+        delete [] m_queues;
+    }
+
+    /**
+     * Number of buffer slots a reader has to provide
+     * (queued frames, frames in process and the frame being read).
+     * Reading pauses while no slot is free, e.g. when frames wait in 
+     * an OrderedFrameWriter for their predecessors.
+     */
+    int slots() const { return m_threads*(m_depth+1)+1; }
+
+    /**
+     * Schedule the frames beg, beg+stride, ... < end.
+     * Must not be called while a thread is in next(). The metrics
+     * are accumulated over several ranges.
+     */
+    void reset(const int beg, const int end, const int stride=1);
+
+    /**
+     * NUMA node of every thread (default: all on node 0).
+     * Must not be called while a thread is in next().
+     */
+    void setNodes(const std::vector<int>& nodeOfThread);
+
+    /**
+     * Thread that should first write the buffer slot, so that it is 
+     * placed on the node of the threads it is used by
+     */
+    int slotOwner(const int slot) const { return slot % m_threads; }
+
+    /**
+     * Next frame for the calling thread (0 <= thread < threads).
+     * The frame was read by reader(frame, slot) into the buffer slot,
+     * which has to be given back with release() when the frame is done.
+     * Returns false when all frames of the range are taken.
+     */
+    template <class Reader>
+    bool next(const int thread, Reader& reader, int& frame, int& slot);
+    void release(const int slot);
+
+    const SchedulerMetrics& metrics(const int thread) const { return m_queues[thread].metrics; }
+    double meanQueueDepth() const { return m_depthSamples > 0 ? (double)m_depthSum/m_depthSamples : 0.; }
+    int maxQueueDepth() const { return m_depthMax; }
+
+    /**
+     * Report the queue depth and the counters of every thread
+     */
+    void printMetrics(std::ostream& os) const;
+
+private:
+    class Item {
+    public:
+        Item(const int frame_, const int slot_) : frame(frame_), slot(slot_) {  }
+        int frame, slot;
+    };
+    class Queue {
+    public:
+        SchedulerLock lock;
+        std::deque<Item> items;
+        SchedulerMetrics metrics; // of the owning thread
+    };
+
+    // not copyable
+    FrameScheduler(const FrameScheduler&);
+    FrameScheduler& operator=(const FrameScheduler&);
+
+    static double wallTime() {
+        #ifdef OPENMP_FOUND
+        return omp_get_wtime();
+        #else
+        return 0.;
+        #endif //OPENMP_FOUND
+    }
+    // take a frame from the front (own queue) or the back (stealing) of queue q
+    bool pop(const int q, const bool front, int& frame, int& slot);
+    // from the longest queue on the node of thread, or else on another node
+    bool steal(const int thread, int& frame, int& slot, bool& remote);
+    // free slot of node, or of another node (-1 if there is none)
+    int takeSlot(const int node);
+    // shortest queue that is not full (-1 if all are), preferring thread.
+    // Also samples the number of queued frames.
+    int shortestQueue(const int thread);
+    // read frames until all queues are full (or no slot is free), with m_readLock set.
+    // Returns false if it stopped because no slot was free.
+    template <class Reader>
+    bool readFrames(const int thread, Reader& reader);
+    // sleep until the number of release() calls differs from releases
+    void waitForRelease(const int releases);
+    static void sleepMicroseconds(const int us) {
+        #if defined(_WIN32)
+        Sleep(std::max(us/1000, 1));
+        #else
+        timespec t;
+        t.tv_sec = 0;
+        t.tv_nsec = 1000L*us;
+        nanosleep(&t, 0);
+        #endif
+    }
+
+    int m_threads, m_depth;
+    Queue * m_queues;
+    SchedulerLock m_readLock; // the reader, also guards m_pos and the depth samples
+    SchedulerLock m_slotLock;
+    std::vector<int> m_nodes; // of the threads
+    std::vector<std::vector<int> > m_freeSlots; // per node
+    int m_releases; // calls of release(), guarded by m_slotLock
+    int m_pos, m_end, m_stride; // next frame to read
+    long m_depthSum;
+    int m_depthSamples, m_depthMax;
+};
+
+inline FrameScheduler::FrameScheduler(const int threads, const int depth)
+    : m_threads(threads), m_depth(depth), m_queues(0), 
+      m_releases(0), m_pos(0), m_end(0), m_stride(1), m_depthSum(0), m_depthSamples(0), m_depthMax(0) {
+    vigra_precondition(threads > 0 && depth > 0, "FrameScheduler: threads and depth must be > 0.");
+    m_queues = new Queue[threads];
+    setNodes(std::vector<int>(threads, 0));
+}
+
+inline void FrameScheduler::setNodes(const std::vector<int>& nodeOfThread) {
+    vigra_precondition((int)nodeOfThread.size() == m_threads, 
+            "FrameScheduler::setNodes(): one node per thread required.");
+    m_nodes = nodeOfThread;
+    const int nodes = *std::max_element(m_nodes.begin(), m_nodes.end())+1;
+    m_freeSlots.assign(nodes, std::vector<int>());
+    for(int s = slots()-1; s >= 0; --s) {
+        m_freeSlots[m_nodes[slotOwner(s)]].push_back(s);
+    }
+}
+
+inline void FrameScheduler::reset(const int beg, const int end, const int stride) {
+    vigra_precondition(stride > 0, "FrameScheduler::reset(): stride must be > 0.");
+    m_pos = beg;
+    m_end = end;
+    m_stride = stride;
+}
+
+template <class Reader>
+bool FrameScheduler::next(const int thread, Reader& reader, int& frame, int& slot) {
+    SchedulerMetrics& metrics = m_queues[thread].metrics;
+    // refill if the own queue runs short and nobody is reading
+    m_queues[thread].lock.set();
+    bool refill = (int)m_queues[thread].items.size() < m_depth;
+    m_queues[thread].lock.unset();
+    if(refill && m_readLock.test()) {
+        readFrames(thread, reader);
+        m_readLock.unset();
+    }
+    bool done = false;
+    double waiting = -1.; // since, excluding the time spent reading
+    for(;;) {
+        bool remote = false;
+        const bool own = pop(thread, true, frame, slot);
+        if(own || steal(thread, frame, slot, remote)) {
+            ++metrics.frames;
+            if(!own) {
+                ++metrics.steals;
+            }
+            if(remote) {
+                ++metrics.remoteSteals;
+            }
+            if(waiting >= 0.) {
+                metrics.idle += wallTime()-waiting;
+            }
+            return true;
+        }
+        if(done) { // all frames were read, and all queues are empty
+            metrics.idle += wallTime()-waiting;
+            return false;
+        }
+        // wait for the reader, or read
+        if(waiting < 0.) {
+            waiting = wallTime();
+        }
+        m_readLock.set();
+        done = (m_pos >= m_end);
+        bool noSlot = false;
+        int releases = 0;
+        if(!done) {
+            m_slotLock.set();
+            releases = m_releases;
+            m_slotLock.unset();
+            const double reading = metrics.reading;
+            const int reads = metrics.reads;
+            noSlot = !readFrames(thread, reader) && metrics.reads == reads;
+            waiting += metrics.reading-reading;
+        }
+        m_readLock.unset();
+        if(noSlot) { // nothing to do until a frame is done
+            waitForRelease(releases);
+        }
+    }
+}
+
+inline void FrameScheduler::release(const int slot) {
+    m_slotLock.set();
+    m_freeSlots[m_nodes[slotOwner(slot)]].push_back(slot);
+    ++m_releases;
+    m_slotLock.unset();
+}
+
+inline void FrameScheduler::waitForRelease(const int releases) {
+    int pause = 20;
+    for(;;) {
+        m_slotLock.set();
+        const bool released = (m_releases != releases);
+        m_slotLock.unset();
+        if(released) {
+            return;
+        }
+        sleepMicroseconds(pause);
+        pause = std::min(2*pause, 1000);
+    }
+}
+
+inline int FrameScheduler::takeSlot(const int node) {
+    int slot = -1;
+    m_slotLock.set();
+    for(int k = 0; k < (int)m_freeSlots.size() && slot < 0; ++k) {
+        std::vector<int>& pool = m_freeSlots[(node+k) % m_freeSlots.size()];
+        if(!pool.empty()) {
+            slot = pool.back();
+            pool.pop_back();
+        }
+    }
+    m_slotLock.unset();
+    return slot;
+}
+
+inline bool FrameScheduler::pop(const int q, const bool front, int& frame, int& slot) {
+    Queue& queue = m_queues[q];
+    queue.lock.set();
+    bool found = !queue.items.empty();
+    if(found) {
+        const Item item = front ? queue.items.front() : queue.items.back();
+        if(front) {
+            queue.items.pop_front();
+        } else {
+            queue.items.pop_back();
+        }
+        frame = item.frame;
+        slot = item.slot;
+    }
+    queue.lock.unset();
+    return found;
+}
+
+inline bool FrameScheduler::steal(const int thread, int& frame, int& slot, bool& remote) {
+    for(;;) {
+        int victim = -1, longest = 0;
+        bool victimRemote = false;
+        for(int k = 1; k < m_threads; ++k) {
+            const int q = (thread+k) % m_threads;
+            m_queues[q].lock.set();
+            const int size = m_queues[q].items.size();
+            m_queues[q].lock.unset();
+            const bool qRemote = (m_nodes[q] != m_nodes[thread]);
+            if(size > 0 && (victim < 0 || (victimRemote && !qRemote) 
+                        || (victimRemote == qRemote && size > longest))) {
+                victim = q;
+                longest = size;
+                victimRemote = qRemote;
+            }
+        }
+        if(victim < 0) {
+            return false;
+        }
+        if(pop(victim, false, frame, slot)) {
+            remote = victimRemote;
+            return true;
+        }
+        // the victim was emptied meanwhile, look again
+    }
+}
+
+inline int FrameScheduler::shortestQueue(const int thread) {
+    int shortest = -1, shortestSize = m_depth, queued = 0;
+    for(int k = 0; k < m_threads; ++k) {
+        const int q = (thread+k) % m_threads;
+        m_queues[q].lock.set();
+        const int size = m_queues[q].items.size();
+        m_queues[q].lock.unset();
+        queued += size;
+        if(size < shortestSize) {
+            shortest = q;
+            shortestSize = size;
+        }
+    }
+    m_depthSum += queued;
+    ++m_depthSamples;
+    m_depthMax = std::max(m_depthMax, queued);
+    return shortest;
+}
+
+template <class Reader>
+bool FrameScheduler::readFrames(const int thread, Reader& reader) {
+    SchedulerMetrics& metrics = m_queues[thread].metrics;
+    const double t0 = wallTime();
+    bool slotFree = true;
+    while(m_pos < m_end) {
+        const int q = shortestQueue(thread);
+        if(q < 0) {
+            break;
+        }
+        const int slot = takeSlot(m_nodes[q]);
+        if(slot < 0) {
+            slotFree = false;
+            break;
+        }
+
+        reader(m_pos, slot);
+        ++metrics.reads;
+
+        m_queues[q].lock.set();
+        m_queues[q].items.push_back(Item(m_pos, slot));
+        m_queues[q].lock.unset();
+        m_pos += m_stride;
+    }
+    metrics.reading += wallTime()-t0;
+    return slotFree;
+}
+
+inline void FrameScheduler::printMetrics(std::ostream& os) const {
+    os << "frame queues: depth " << m_depth << " per thread, " << std::fixed << std::setprecision(1) 
+       << meanQueueDepth() << " frames queued on average, " << maxQueueDepth() << " at most" << std::endl;
+    for(int t = 0; t < m_threads; ++t) {
+        const SchedulerMetrics& m = metrics(t);
+        os << "  thread " << t << ": " << m.frames << " frames (" << m.steals << " stolen";
+        if(m_freeSlots.size() > 1) {
+            os << ", " << m.remoteSteals << " from other nodes";
+        }
+        os << "), " << m.reads << " read, idle " << std::setprecision(3) << m.idle << " s, reading " 
+           << m.reading << " s" << std::endl;
+    }
+    os.unsetf(std::ios_base::floatfield);
+    os << std::setprecision(6);
+}
+
+#endif // FRAMESCHEDULER_H
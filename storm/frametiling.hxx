@@ -0,0 +1,234 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef FRAMETILING_H
+#define FRAMETILING_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <vigra/error.hxx>
+#include <vigra/basicimage.hxx>
+#include <vigra/basicimageview.hxx>
+#include <vigra/copyimage.hxx>
+#include <vigra/fftw3.hxx>
+#include "fftfilter.hxx"
+
+/*
+ * Processing of large frames in tiles
+ *
+ * The frame is divided into cores of tileSize() x tileSize() pixels.
+ * A tile is processed on its core extended by halo() pixels on every
+ * side (the area, clipped to the frame), so that the ROIs and the
+ * background of the candidates in the core are (nearly) the same as 
+ * in the full frame.
+ *
+ * The Wiener filter is applied by overlap-save: Its impulse response
+ * is truncated to the pixels above tolerance*peak (filterRadius()), but
+ * at most to maxRadius, so that the FFT of a tile stays small for 
+ * noisy filters, and transformed to the FFT size of a tile, i.e. the area plus another 
+ * filterRadius() pixels on every side. The margin is discarded after 
+ * the inverse transform. Pixels outside the frame are wrapped around, 
+ * as in the full-frame FFT. truncationError() is the largest value of
+ * the impulse response beyond the radius relative to the peak.
+ *
+ * The plans and the spectrum are shared by all threads, the buffers
+ * of a tile are passed in (see FrameWorkspace), so the memory per 
+ * thread does not depend on the frame size.
+ */
+
+using namespace vigra; // for now
+
+template <class T>
+class FrameTiling {
+public:
+    typedef T value_type;
+    typedef vigra::BasicImageView<vigra::FFTWComplex<float> > ComplexImageView;
+
+    /**
+     * Tiles of frames of the size of filter, filtered by fftwWrapper
+     * with a radius of at most maxRadius.
+     * NOT THREAD-SAFE (creates FFT plans).
+     */
+    FrameTiling(const BasicImage<T>& filter, const FFTFilter<T>& fftwWrapper,
+            const int tileSize, const int halo, const int maxRadius, 
+            const double tolerance=1e-3);
+    ~FrameTiling() {
+        delete m_fft;
+    }
+
+    int tileSize() const { return m_tileSize; }
+    int halo() const { return m_halo; }
+    int filterRadius() const { return m_radius; }
+    double tolerance() const { return m_tolerance; }
+    double truncationError() const { return m_truncationError; }
+    Diff2D frameSize() const { return Diff2D(m_w, m_h); }
+    // size of the FFT input of a tile (area and filter margin)
+    Diff2D fftSize() const { return m_fftSize; }
+
+    /**
+     * Number of tiles per frame
+     */
+    int size() const { return m_tilesX*m_tilesY; }
+
+    /**
+     * Core [core_ul, core_lr) and area [area_ul, area_lr) of tile i
+     * (in pixels of the frame)
+     */
+    void tile(const int i, Diff2D& core_ul, Diff2D& core_lr, Diff2D& area_ul, Diff2D& area_lr) const;
+
+    /**
+     * Filter the area [area_ul, area_lr) of the frame into filtered 
+     * (of size area_lr-area_ul).
+     * fftIn and fftOut are buffers of fftSize(), complexImg of the
+     * size of the half spectrum.
+     */
+    template <class Image>
+    void filterTile(const Image& frame, const Diff2D& area_ul, const Diff2D& area_lr,
+            BasicImageView<T>& fftIn, BasicImageView<T>& fftOut, ComplexImageView& complexImg, 
+            BasicImageView<T>& filtered) const;
+
+private:
+    // not copyable
+    FrameTiling(const FrameTiling&);
+    FrameTiling& operator=(const FrameTiling&);
+
+    static int wrap(const int i, const int n) {
+        return (i < 0) ? i+n : ((i >= n) ? i-n : i);
+    }
+
+    int m_w, m_h, m_tileSize, m_halo, m_radius, m_tilesX, m_tilesY;
+    double m_tolerance, m_truncationError;
+    Diff2D m_fftSize;
+    BasicImage<T> m_spectrum; // of the truncated filter at fftSize()
+    FFTFilter<T> * m_fft;     // plans for fftSize()
+};
+
+template <class T>
+FrameTiling<T>::FrameTiling(const BasicImage<T>& filter, const FFTFilter<T>& fftwWrapper,
+            const int tileSize, const int halo, const int maxRadius, const double tolerance)
+    : m_w(filter.width()), m_h(filter.height()), m_tileSize(tileSize), m_halo(halo), 
+      m_tolerance(tolerance), m_truncationError(0.), m_fft(0) {
+    vigra_precondition(tileSize > 0 && halo >= 0, "FrameTiling: tileSize must be > 0.");
+    vigra_precondition(maxRadius > 0, "FrameTiling: maxRadius must be > 0.");
+    m_tilesX = (m_w+tileSize-1)/tileSize;
+    m_tilesY = (m_h+tileSize-1)/tileSize;
+
+    // impulse response of the filter, centered at (0,0) and periodic
+    BasicImage<T> delta(m_w, m_h);
+    delta(0,0) = 1;
+    BasicImage<T> kernel(m_w, m_h);
+    fftwWrapper.applyFourierFilter(srcImageRange(delta), srcImage(filter), destImage(kernel));
+
+    // support: the largest ring around the center with a value above the 
+    // tolerance, at most maxRadius (and half the frame)
+    const int halfFrame = std::max(1, (std::min(m_w, m_h)-1)/2);
+    std::vector<double> ring(halfFrame+1, 0.);
+    for(int dy = -halfFrame; dy <= halfFrame; ++dy) {
+        for(int dx = -halfFrame; dx <= halfFrame; ++dx) {
+            int r = std::max(std::abs(dx), std::abs(dy));
+            ring[r] = std::max(ring[r], (double)std::abs(kernel(wrap(dx, m_w), wrap(dy, m_h))));
+        }
+    }
+    m_radius = 1;
+    for(int r = 1; r <= std::min(maxRadius, halfFrame); ++r) {
+        if(ring[r] > tolerance*ring[0]) {
+            m_radius = r;
+        }
+    }
+    for(int r = m_radius+1; r <= halfFrame; ++r) {
+        if(ring[0] > 0.) {
+            m_truncationError = std::max(m_truncationError, ring[r]/ring[0]);
+        }
+    }
+
+    const int areaW = std::min(m_w, tileSize+2*halo);
+    const int areaH = std::min(m_h, tileSize+2*halo);
+    m_fftSize = Diff2D(areaW+2*m_radius, areaH+2*m_radius);
+
+    // the truncated kernel is even, so its spectrum is real
+    BasicImage<T> truncated(m_fftSize);
+    for(int dy = -m_radius; dy <= m_radius; ++dy) {
+        for(int dx = -m_radius; dx <= m_radius; ++dx) {
+            truncated(wrap(dx, m_fftSize.x), wrap(dy, m_fftSize.y)) = 
+                kernel(wrap(dx, m_w), wrap(dy, m_h));
+        }
+    }
+    vigra::FFTWComplexImage spectrum(m_fftSize);
+    fourierTransform(srcImageRange(truncated), destImage(spectrum));
+    m_spectrum.resize(m_fftSize);
+    for(int y = 0; y < m_fftSize.y; ++y) {
+        for(int x = 0; x < m_fftSize.x; ++x) {
+            m_spectrum(x, y) = spectrum(x, y).re();
+        }
+    }
+
+    BasicImage<T> sample(m_fftSize);
+    m_fft = new FFTFilter<T>(srcImageRange(sample));
+}
+
+template <class T>
+void FrameTiling<T>::tile(const int i, Diff2D& core_ul, Diff2D& core_lr, Diff2D& area_ul, Diff2D& area_lr) const {
+    vigra_precondition(i >= 0 && i < size(), "FrameTiling::tile(): index out of range.");
+    core_ul = Diff2D((i % m_tilesX)*m_tileSize, (i / m_tilesX)*m_tileSize);
+    core_lr = Diff2D(std::min(core_ul.x+m_tileSize, m_w), std::min(core_ul.y+m_tileSize, m_h));
+    area_ul = Diff2D(std::max(core_ul.x-m_halo, 0), std::max(core_ul.y-m_halo, 0));
+    area_lr = Diff2D(std::min(core_lr.x+m_halo, m_w), std::min(core_lr.y+m_halo, m_h));
+}
+
+template <class T>
+template <class Image>
+void FrameTiling<T>::filterTile(const Image& frame, const Diff2D& area_ul, const Diff2D& area_lr,
+            BasicImageView<T>& fftIn, BasicImageView<T>& fftOut, ComplexImageView& complexImg, 
+            BasicImageView<T>& filtered) const {
+    const Diff2D size = area_lr-area_ul;
+    const int r = m_radius;
+    vigra_precondition(frame.width() == m_w && frame.height() == m_h,
+        "FrameTiling::filterTile(): frame has the wrong size.");
+    vigra_precondition(fftIn.size() == m_fftSize && fftOut.size() == m_fftSize && filtered.size() == size,
+        "FrameTiling::filterTile(): buffers have the wrong size.");
+    // smaller areas (at the right and lower border) are padded with zeros,
+    // which only reach the discarded margin
+    std::fill(fftIn.begin(), fftIn.end(), T());
+    for(int y = 0; y < size.y+2*r; ++y) {
+        const int sy = wrap(area_ul.y-r+y, m_h);
+        for(int x = 0; x < size.x+2*r; ++x) {
+            fftIn(x, y) = frame(wrap(area_ul.x-r+x, m_w), sy);
+        }
+    }
+    m_fft->applyFourierFilter(srcImageRange(fftIn), srcImage(m_spectrum), destImage(fftOut), complexImg);
+    copyImage(srcIterRange(fftOut.upperLeft()+Diff2D(r,r), fftOut.upperLeft()+Diff2D(r,r)+size),
+            destImage(filtered));
+}
+
+#endif // FRAMETILING_H
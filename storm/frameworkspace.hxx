@@ -0,0 +1,310 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+#ifndef FRAMEWORKSPACE_H
+#define FRAMEWORKSPACE_H
+
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <vigra/basicimageview.hxx>
+#include <vigra/fftw3.hxx>
+#ifdef OPENMP_FOUND
+    #include <omp.h>
+#endif //OPENMP_FOUND
+#include "backgroundfilter.hxx"
+#include "fourierinterpolation.hxx"
+#include "gaussianfit.hxx"
+#include "splineupsampling.hxx"
+#include "splinehessian.hxx"
+#include "allocationcounter.hxx"
+
+/*
+ * Scratch memory for the processing of single frames
+ *
+ * Every thread owns one workspace that is passed to
+ * wienerStormSingleFrame(). All buffers are allocated with fftwf_malloc
+ * (aligned for SIMD) when the workspace is reshaped to a new frame size,
+ * so that processing a stack of equally sized frames does not allocate
+ * any image memory per frame. allocations() counts these buffers. What
+ * only some methods need (the upsampled frame, the tile buffers, the 
+ * Gaussian fit and the Fourier interpolation matrices) is set up at its
+ * first use after reshape(). The vectors keep their capacity from frame to frame, they only grow if a
+ * frame has more candidates or spots than all earlier ones. Builds with
+ * STORM_COUNT_ALLOCATIONS count every allocation (see allocationcounter.hxx)
+ * and check that a frame is localized without any. For tiled processing 
+ * (see FrameTiling), the workspace is shaped for the FFT size of a tile 
+ * instead.
+ *
+ * A frame can be processed by several threads (setThreads()): The 
+ * background filter splits the frame, and the regions are upsampled 
+ * in parallel, each thread with its own RegionWorkspace.
+ */
+
+using namespace vigra; // for now
+
+template <class T>
+class Coord;
+
+/**
+ * Rectangular region of a frame that is upsampled at once.
+ * It is the bounding box of the ROIs of one or more maximum candidates.
+ */
+class CandidateRegion {
+    public:
+        CandidateRegion(const Diff2D& ul_, const Diff2D& lr_, const int member)
+            : ul(ul_), lr(lr_), first(member), last(member) {  }
+        Diff2D ul, lr;   // in pixels of the frame
+        int first, last; // candidates in the region, see FrameWorkspace::nextMember
+};
+
+/**
+ * How the candidates of a frame (or tile) are upsampled by the spline method
+ */
+enum UpsamplingStrategy {
+    ROI_UPSAMPLING,    // every ROI on its own
+    REGION_UPSAMPLING, // merged regions of overlapping ROIs, see CandidateRegion
+    FRAME_UPSAMPLING   // the whole frame at once
+};
+
+/**
+ * Strategy chosen for a frame (or tile), with the numbers it is based on
+ */
+class UpsamplingChoice {
+    public:
+        UpsamplingChoice(const UpsamplingStrategy strategy_=REGION_UPSAMPLING, 
+                    const int candidates_=0, const double coverage_=0.)
+            : strategy(strategy_), candidates(candidates_), coverage(coverage_) {  }
+        UpsamplingStrategy strategy;
+        int candidates;  // candidates that are upsampled
+        double coverage; // summed area of their ROIs relative to the frame
+};
+
+/**
+ * Scratch memory to upsample a CandidateRegion (or the neighbourhood
+ * of a candidate), one per thread working on a frame.
+ */
+template <class T>
+class RegionWorkspace {
+public:
+    typedef vigra::BasicImageView<T> ImageView;
+
+    ImageView im_xxl;     // upsampled region (up to maxRegionLen() pixels)
+    FourierInterpolation<T> fourierInterpolation;
+    SplineUpsampling<T> splineUpsampling;
+    std::vector<int> maximaIndices;      // scratch buffer for localMaximaIndices()
+    std::vector<Coord<T> > regionMaxima; // maxima of one upsampled region
+};
+
+template <class T>
+class FrameWorkspace {
+public:
+    typedef T value_type;
+    typedef vigra::BasicImageView<T> ImageView;
+    typedef vigra::BasicImageView<vigra::FFTWComplex<float> > ComplexImageView;
+
+    FrameWorkspace()
+        : m_w(0), m_h(0), m_factor(0), m_mylen(0), m_threads(1), m_allocations(0) {  }
+    FrameWorkspace(const int w, const int h, const int factor, const int mylen)
+        : m_w(0), m_h(0), m_factor(0), m_mylen(0), m_threads(1), m_allocations(0) {
+        reshape(w, h, factor, mylen);
+    }
+    ~FrameWorkspace() {
+        release();
+    }
+
+    /**
+     * Make sure all buffers fit a frame of size w x h.
+     * Memory is only (re-)allocated if the parameters changed.
+     */
+    void reshape(const int w, const int h, const int factor, const int mylen);
+
+    /**
+     * Number of threads that work on one frame (default: 1).
+     * The buffers are allocated at the next reshape().
+     */
+    void setThreads(const int threads);
+    int threads() const { return m_threads; }
+
+    /**
+     * Scratch memory of the calling thread within a frame
+     */
+    RegionWorkspace<T> & regionWorkspace() {
+        #ifdef OPENMP_FOUND
+        return regionWorkspaces[omp_get_thread_num()];
+        #else
+        return regionWorkspaces[0];
+        #endif //OPENMP_FOUND
+    }
+
+    /**
+     * Buffer for the whole upsampled frame (FRAME_UPSAMPLING), it is
+     * allocated at the first call after reshape()
+     */
+    ImageView & upsampledFrame();
+
+    /**
+     * Buffers of the size of the workspace for tiled processing 
+     * (i < 3: FFT input and output, raw data of a tile), each is 
+     * allocated at its first call after reshape()
+     */
+    ImageView & tileBuffer(const int i);
+
+    /**
+     * Batched fit of ROIs of the current length (MLE method), it is
+     * set up at its first call after reshape()
+     */
+    GaussianFit<T> & gaussianFit();
+
+    /**
+     * Number of image buffers allocated (fftwf_malloc) since construction
+     */
+    unsigned int allocations() const { return m_allocations; }
+
+    /**
+     * Maximal side length of a CandidateRegion (in pixels of the frame)
+     */
+    int maxRegionLen() const { return 3*m_mylen; }
+
+    ImageView filtered;   // filtered frame
+    ImageView bg;         // background
+    ComplexImageView complexImg;  // spectrum of the frame
+    BackgroundFilter<T> backgroundFilter;
+    std::vector<RegionWorkspace<T> > regionWorkspaces; // one per thread
+    SplineHessian<T> splineHessian;     // asymmetry of the maxima
+    std::vector<Coord<T> > candidates; // maxima of the filtered frame
+    std::vector<int> maximaIndices;    // scratch buffer for localMaximaIndices()
+    std::vector<int> candidateIndices; // candidates from BackgroundFilter::subtract()
+    std::vector<CandidateRegion> regions; // merged ROIs of the candidates
+    std::vector<int> nextMember;       // linked list of the candidates in a region
+    std::vector<std::vector<Coord<T> > > taskMaxima; // maxima per region (or candidate), in order
+    std::vector<Coord<T> > tileMaxima;   // maxima of one tile (tiled processing)
+    std::vector<Coord<T> > sortBuffer;   // scratch buffer for squeezeDuplicates()
+    std::vector<UpsamplingChoice> upsamplingChoices; // of the current frame (one per tile)
+
+private:
+    // not copyable
+    FrameWorkspace(const FrameWorkspace&);
+    FrameWorkspace& operator=(const FrameWorkspace&);
+
+    template <class V>
+    vigra::BasicImageView<V> allocate(const int w, const int h) {
+        ++m_allocations;
+        countAllocation();
+        V * data = (V *)fftwf_malloc(sizeof(V)*w*h);
+        if(data == 0) {
+            throw std::bad_alloc();
+        }
+        m_buffers.push_back(data);
+        return vigra::BasicImageView<V>(data, w, h);
+    }
+    void release() {
+        for(unsigned int i = 0; i < m_buffers.size(); ++i) {
+            fftwf_free(m_buffers[i]);
+        }
+        m_buffers.clear();
+    }
+
+    int m_w, m_h, m_factor, m_mylen, m_threads;
+    unsigned int m_allocations;
+    ImageView m_frame_xxl;
+    ImageView m_tileBuffers[3];
+    GaussianFit<T> m_gaussianFit;
+    std::vector<void *> m_buffers;
+};
+
+template <class T>
+void FrameWorkspace<T>::setThreads(const int threads) {
+    vigra_precondition(threads > 0, "FrameWorkspace::setThreads(): threads must be > 0.");
+    if(threads != m_threads) {
+        m_threads = threads;
+        m_w = 0; // reallocate at the next reshape()
+        backgroundFilter.setThreads(threads);
+    }
+}
+
+template <class T>
+void FrameWorkspace<T>::reshape(const int w, const int h, const int factor, const int mylen) {
+    if(w == m_w && h == m_h && factor == m_factor && mylen == m_mylen) {
+        return;
+    }
+    release();
+    m_buffers.reserve(8+m_threads);
+    m_frame_xxl = ImageView();
+    for(int i = 0; i < 3; ++i) {
+        m_tileBuffers[i] = ImageView();
+    }
+    m_mylen = mylen;
+    int len_xxl = factor*(maxRegionLen()-1)+1;
+    filtered = allocate<T>(w, h);
+    bg = allocate<T>(w, h);
+    complexImg = allocate<vigra::FFTWComplex<float> >(w/2+1, h);
+    regionWorkspaces.resize(m_threads);
+    for(int t = 0; t < m_threads; ++t) {
+        RegionWorkspace<T> & rw = regionWorkspaces[t];
+        rw.im_xxl = allocate<T>(len_xxl, len_xxl);
+        rw.fourierInterpolation = FourierInterpolation<T>(factor, maxRegionLen());
+        rw.splineUpsampling.init(BSplineWOPrefilter<3,double>(), factor);
+        rw.maximaIndices.resize(len_xxl*len_xxl);
+    }
+    maximaIndices.resize(w*h);
+    m_w = w;
+    m_h = h;
+    m_factor = factor;
+}
+
+template <class T>
+typename FrameWorkspace<T>::ImageView & FrameWorkspace<T>::upsampledFrame() {
+    if(m_frame_xxl.width() == 0) {
+        m_frame_xxl = allocate<T>(m_factor*(m_w-1)+1, m_factor*(m_h-1)+1);
+    }
+    return m_frame_xxl;
+}
+
+template <class T>
+GaussianFit<T> & FrameWorkspace<T>::gaussianFit() {
+    if(m_gaussianFit.roilen() != m_mylen) {
+        m_gaussianFit = GaussianFit<T>(m_mylen);
+    }
+    return m_gaussianFit;
+}
+
+template <class T>
+typename FrameWorkspace<T>::ImageView & FrameWorkspace<T>::tileBuffer(const int i) {
+    vigra_precondition(i >= 0 && i < 3, "FrameWorkspace::tileBuffer(): index out of range.");
+    if(m_tileBuffers[i].width() == 0) {
+        m_tileBuffers[i] = allocate<T>(m_w, m_h);
+    }
+    return m_tileBuffers[i];
+}
+
+#endif // FRAMEWORKSPACE_H
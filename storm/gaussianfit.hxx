@@ -0,0 +1,354 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef GAUSSIANFIT_H
+#define GAUSSIANFIT_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <vigra/error.hxx>
+
+/*
+ * Maximum likelihood fit of a Gaussian PSF to the raw data around 
+ * maximum candidates.
+ *
+ * The model of a spot in a ROI of len x len pixels is
+ *   mu(u,v) = b + I/(2 pi s^2) exp(-((u-x)^2+(v-y)^2)/(2 s^2))
+ * with the position (x,y), the number of counts I, background b and 
+ * width s. The pixel values are assumed to be Poisson distributed, 
+ * the log-likelihood is maximized with Levenberg-Marquardt iterations
+ * using the Fisher information as approximation of the Hessian.
+ * The uncertainty of the position is given by the Cramer-Rao lower 
+ * bound, i.e. the inverse Fisher information at the optimum.
+ *
+ * Spots are collected in batches that are fitted together. All arrays
+ * are stored as structure of arrays with the spot index running
+ * fastest, so the loops over the spots of a batch are vectorized by the
+ * compiler. The Gaussian is separable, so only 2*len exponentials per
+ * spot and iteration are needed.
+ */
+
+template <class T>
+class GaussianFit {
+public:
+    typedef T value_type;
+
+    GaussianFit(const int len=0, const int batchSize=32, const double sigma=1.3);
+
+    int roilen() const { return m_len; }
+    int size() const { return m_size; }
+    bool full() const { return m_size == m_batchSize; }
+    /** Start collecting a new batch */
+    void clear() { m_size = 0; }
+
+    /**
+     * Add the ROI with upper left corner (x0, y0) of the image 
+     * to the batch. (x, y) is the start position in image coordinates.
+     */
+    template <class Image>
+    void addSpot(const Image& im, const int x0, const int y0, const double x, const double y);
+
+    /** Fit all spots of the batch */
+    void fit(const int maxIterations=20);
+
+    // results of spot i in image coordinates
+    double x(const int i) const { return m_x0[i] + m_p[PX*m_batchSize+i]; }
+    double y(const int i) const { return m_y0[i] + m_p[PY*m_batchSize+i]; }
+    double intensity(const int i) const { return m_p[PI*m_batchSize+i]; }
+    double background(const int i) const { return m_p[PB*m_batchSize+i]; }
+    double sigma(const int i) const { return m_p[PS*m_batchSize+i]; }
+    /** Cramer-Rao bound of the position (mean standard deviation of x and y) */
+    double uncertainty(const int i) const { return m_uncertainty[i]; }
+    /** The fit converged to a spot inside the ROI */
+    bool valid(const int i) const { return m_valid[i]; }
+
+private:
+    enum { PX, PY, PI, PB, PS, NPARAM }; // parameters
+    enum { NFISHER = NPARAM*(NPARAM+1)/2 }; // upper triangle of the Fisher matrix
+
+    void evaluate();
+    void unpack(const int s, const std::vector<double>& fisher, double F[NPARAM][NPARAM]) const;
+    static bool choleskySolve(double A[NPARAM][NPARAM], const double b[NPARAM], double x[NPARAM]);
+
+    int m_len, m_batchSize, m_size;
+    double m_sigma;
+    std::vector<int> m_x0, m_y0;
+    std::vector<double> m_data;      // m_data[k*m_batchSize+s]: pixel k of spot s
+    std::vector<double> m_p, m_pPrev;// m_p[j*m_batchSize+s]: parameter j of spot s
+    std::vector<double> m_ll, m_llPrev;
+    std::vector<double> m_grad, m_gradPrev;
+    std::vector<double> m_fisher, m_fisherPrev;
+    std::vector<double> m_lambda;
+    std::vector<char> m_done, m_valid;
+    std::vector<double> m_uncertainty;
+    // separable parts of the model: m_ex[u*m_batchSize+s], m_du[u*m_batchSize+s]
+    std::vector<double> m_ex, m_ey, m_du, m_dv;
+    std::vector<double> m_amp, m_norm, m_is2;
+};
+
+template <class T>
+GaussianFit<T>::GaussianFit(const int len, const int batchSize, const double sigma)
+    : m_len(len), m_batchSize(batchSize), m_size(0), m_sigma(sigma),
+      m_x0(batchSize), m_y0(batchSize),
+      m_data(len*len*batchSize),
+      m_p(NPARAM*batchSize), m_pPrev(NPARAM*batchSize),
+      m_ll(batchSize), m_llPrev(batchSize),
+      m_grad(NPARAM*batchSize), m_gradPrev(NPARAM*batchSize),
+      m_fisher(NFISHER*batchSize), m_fisherPrev(NFISHER*batchSize),
+      m_lambda(batchSize), m_done(batchSize), m_valid(batchSize), m_uncertainty(batchSize),
+      m_ex(len*batchSize), m_ey(len*batchSize), m_du(len*batchSize), m_dv(len*batchSize),
+      m_amp(batchSize), m_norm(batchSize), m_is2(batchSize) {
+}
+
+template <class T>
+template <class Image>
+void GaussianFit<T>::addSpot(const Image& im, const int x0, const int y0, const double x, const double y) {
+    vigra_precondition(m_size < m_batchSize, "GaussianFit::addSpot(): batch is full.");
+    vigra_precondition(x0 >= 0 && y0 >= 0 && x0+m_len <= im.width() && y0+m_len <= im.height(),
+        "GaussianFit::addSpot(): ROI outside of the image.");
+    const int s = m_size++;
+    const int B = m_batchSize;
+    double sum = 0., minval = im(x0, y0);
+    for(int v = 0; v < m_len; ++v) {
+        for(int u = 0; u < m_len; ++u) {
+            double val = std::max((double)im(x0+u, y0+v), 0.);
+            m_data[(v*m_len+u)*B+s] = val;
+            sum += val;
+            minval = std::min(minval, val);
+        }
+    }
+    m_x0[s] = x0;
+    m_y0[s] = y0;
+    m_p[PX*B+s] = x - x0;
+    m_p[PY*B+s] = y - y0;
+    m_p[PB*B+s] = std::max(minval, 1.);
+    m_p[PI*B+s] = std::max(sum - m_len*m_len*m_p[PB*B+s], 1.);
+    m_p[PS*B+s] = m_sigma;
+}
+
+/**
+ * Log-likelihood, gradient and Fisher information of all spots 
+ * at the current parameters m_p
+ */
+template <class T>
+void GaussianFit<T>::evaluate() {
+    const int B = m_batchSize;
+    const int n = m_size;
+    const int L = m_len;
+    for(int s = 0; s < n; ++s) {
+        double sig = m_p[PS*B+s];
+        m_is2[s] = 1./(sig*sig);
+        m_norm[s] = 1./(2.*M_PI*sig*sig);
+        m_amp[s] = m_p[PI*B+s]*m_norm[s];
+        for(int u = 0; u < L; ++u) {
+            double du = u - m_p[PX*B+s];
+            double dv = u - m_p[PY*B+s];
+            m_du[u*B+s] = du;
+            m_dv[u*B+s] = dv;
+            m_ex[u*B+s] = std::exp(-0.5*du*du*m_is2[s]);
+            m_ey[u*B+s] = std::exp(-0.5*dv*dv*m_is2[s]);
+        }
+    }
+    std::fill(m_ll.begin(), m_ll.end(), 0.);
+    std::fill(m_grad.begin(), m_grad.end(), 0.);
+    std::fill(m_fisher.begin(), m_fisher.end(), 0.);
+
+    const double * bg = &m_p[PB*B];
+    const double * sigma = &m_p[PS*B];
+    for(int v = 0; v < L; ++v) {
+        for(int u = 0; u < L; ++u) {
+            const double * data = &m_data[(v*L+u)*B];
+            const double * ex = &m_ex[u*B];
+            const double * ey = &m_ey[v*B];
+            const double * du = &m_du[u*B];
+            const double * dv = &m_dv[v*B];
+            for(int s = 0; s < n; ++s) { // vectorized over the spots
+                double G = ex[s]*ey[s];
+                double AG = m_amp[s]*G;
+                double d[NPARAM];
+                d[PX] = AG*du[s]*m_is2[s];
+                d[PY] = AG*dv[s]*m_is2[s];
+                d[PI] = G*m_norm[s];
+                d[PB] = 1.;
+                d[PS] = AG*((du[s]*du[s]+dv[s]*dv[s])*m_is2[s] - 2.)/sigma[s];
+                double mu = std::max(bg[s] + AG, 1e-6);
+                m_ll[s] += data[s]*std::log(mu) - mu;
+                double r = data[s]/mu - 1.;
+                double w = 1./mu;
+                int f = 0;
+                for(int i = 0; i < NPARAM; ++i) {
+                    m_grad[i*B+s] += r*d[i];
+                    for(int j = i; j < NPARAM; ++j, ++f) {
+                        m_fisher[f*B+s] += w*d[i]*d[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class T>
+void GaussianFit<T>::unpack(const int s, const std::vector<double>& fisher, double F[NPARAM][NPARAM]) const {
+    int f = 0;
+    for(int i = 0; i < NPARAM; ++i) {
+        for(int j = i; j < NPARAM; ++j, ++f) {
+            F[i][j] = F[j][i] = fisher[f*m_batchSize+s];
+        }
+    }
+}
+
+/**
+ * Solve A x = b for symmetric positive definite A (A is overwritten)
+ */
+template <class T>
+bool GaussianFit<T>::choleskySolve(double A[NPARAM][NPARAM], const double b[NPARAM], double x[NPARAM]) {
+    for(int j = 0; j < NPARAM; ++j) {
+        double d = A[j][j];
+        for(int k = 0; k < j; ++k) {
+            d -= A[j][k]*A[j][k];
+        }
+        if(!(d > 0.)) {
+            return false;
+        }
+        A[j][j] = std::sqrt(d);
+        for(int i = j+1; i < NPARAM; ++i) {
+            double a = A[i][j];
+            for(int k = 0; k < j; ++k) {
+                a -= A[i][k]*A[j][k];
+            }
+            A[i][j] = a / A[j][j];
+        }
+    }
+    for(int i = 0; i < NPARAM; ++i) { // forward substitution
+        double a = b[i];
+        for(int k = 0; k < i; ++k) {
+            a -= A[i][k]*x[k];
+        }
+        x[i] = a / A[i][i];
+    }
+    for(int i = NPARAM-1; i >= 0; --i) { // backward substitution
+        double a = x[i];
+        for(int k = i+1; k < NPARAM; ++k) {
+            a -= A[k][i]*x[k];
+        }
+        x[i] = a / A[i][i];
+    }
+    return true;
+}
+
+template <class T>
+void GaussianFit<T>::fit(const int maxIterations) {
+    const int B = m_batchSize;
+    const int n = m_size;
+    std::fill(m_lambda.begin(), m_lambda.end(), 1e-3);
+    std::fill(m_done.begin(), m_done.end(), 0);
+
+    for(int it = 0; it < maxIterations; ++it) {
+        evaluate();
+        bool allDone = true;
+        for(int s = 0; s < n; ++s) {
+            if(m_done[s]) {
+                continue;
+            }
+            if(it > 0 && m_ll[s] < m_llPrev[s]) { // step rejected: go back
+                for(int j = 0; j < NPARAM; ++j) {
+                    m_p[j*B+s] = m_pPrev[j*B+s];
+                }
+                m_lambda[s] *= 10.;
+            } else { // step accepted
+                for(int j = 0; j < NPARAM; ++j) {
+                    m_pPrev[j*B+s] = m_p[j*B+s];
+                    m_gradPrev[j*B+s] = m_grad[j*B+s];
+                }
+                for(int f = 0; f < NFISHER; ++f) {
+                    m_fisherPrev[f*B+s] = m_fisher[f*B+s];
+                }
+                m_llPrev[s] = m_ll[s];
+                m_lambda[s] = std::max(m_lambda[s]/10., 1e-7);
+            }
+
+            // damped step from the last accepted parameters
+            double F[NPARAM][NPARAM], g[NPARAM], delta[NPARAM];
+            unpack(s, m_fisherPrev, F);
+            for(int j = 0; j < NPARAM; ++j) {
+                F[j][j] *= 1. + m_lambda[s];
+                g[j] = m_gradPrev[j*B+s];
+            }
+            if(!choleskySolve(F, g, delta) || m_lambda[s] > 1e10) {
+                m_done[s] = 1;
+                continue;
+            }
+            if(std::fabs(delta[PX]) < 1e-4 && std::fabs(delta[PY]) < 1e-4) {
+                m_done[s] = 1;
+                continue;
+            }
+            allDone = false;
+            // keep the parameters in a physically meaningful range
+            m_p[PX*B+s] = m_pPrev[PX*B+s] + delta[PX];
+            m_p[PY*B+s] = m_pPrev[PY*B+s] + delta[PY];
+            m_p[PI*B+s] = std::max(m_pPrev[PI*B+s] + delta[PI], 0.1*m_pPrev[PI*B+s]);
+            m_p[PB*B+s] = std::max(m_pPrev[PB*B+s] + delta[PB], 1e-3);
+            m_p[PS*B+s] = std::min(std::max(m_pPrev[PS*B+s] + delta[PS], 0.3), 0.5*m_len);
+        }
+        if(allDone) {
+            break;
+        }
+    }
+
+    // results at the last accepted parameters
+    for(int j = 0; j < NPARAM; ++j) {
+        for(int s = 0; s < n; ++s) {
+            m_p[j*B+s] = m_pPrev[j*B+s];
+        }
+    }
+    for(int s = 0; s < n; ++s) {
+        double F[NPARAM][NPARAM], e[NPARAM] = {0., 0., 0., 0., 0.}, col[NPARAM];
+        double variance = 0.;
+        bool ok = true;
+        for(int j = PX; j <= PY; ++j) { // diagonal of the inverse Fisher matrix
+            unpack(s, m_fisherPrev, F);
+            e[j] = 1.;
+            ok = ok && choleskySolve(F, e, col);
+            e[j] = 0.;
+            variance += col[j];
+        }
+        m_uncertainty[s] = ok ? std::sqrt(0.5*variance) : -1.;
+        m_valid[s] = ok
+            && m_p[PX*B+s] >= 0. && m_p[PX*B+s] <= m_len-1
+            && m_p[PY*B+s] >= 0. && m_p[PY*B+s] <= m_len-1
+            && m_p[PI*B+s] > 0.;
+    }
+}
+
+#endif // GAUSSIANFIT_H
@@ -0,0 +1,239 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+#ifndef LOCALMAXIMA_H
+#define LOCALMAXIMA_H
+
+#include "cpudispatch.hxx"
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+#if defined(__AVX__) || defined(STORM_MULTIVERSIONING)
+    #include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+/*
+ * Detection of local maxima in the 8-neighbourhood
+ *
+ * This gives the same result as
+ *   vigra::localMaxima(..., vigra::LocalMinmaxOptions().threshold(threshold))
+ * on a w x h region: A pixel is a maximum if it is strictly larger than
+ * the threshold and all of its 8 neighbours. Pixels at the border of
+ * the region are never maxima, but they are used as neighbours.
+ *
+ * Instead of marking the maxima via an accessor, their offsets
+ * (y*stride+x, relative to upperLeft) are written to a compact buffer
+ * in row-major order. The buffer must hold at least (w-2)*(h-2) entries.
+ * For float data, whole rows are compared with SSE (or AVX, if the
+ * compiler is allowed to use it) and the resulting bit masks are
+ * compacted into the buffer. AVX2 and AVX-512 are chosen at runtime
+ * if the CPU supports them, see cpuPath().
+ */
+
+template <class T>
+inline bool isLocalMaximum(const T * p, const int stride, const T threshold) {
+    const T v = *p;
+    return v > threshold
+        && v > p[-stride-1] && v > p[-stride] && v > p[-stride+1]
+        && v > p[-1]                          && v > p[1]
+        && v > p[stride-1]  && v > p[stride]  && v > p[stride+1];
+}
+
+// append the positions of the set bits in mask
+inline int compactMask(unsigned int mask, const int offset, int * indices, int n) {
+    while(mask) {
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanForward(&bit, mask);
+#else
+        int bit = __builtin_ctz(mask);
+#endif
+        indices[n++] = offset + bit;
+        mask &= mask-1;
+    }
+    return n;
+}
+
+/**
+ * Find local maxima in a region of a row-major image
+ *
+ * @return number of maxima written to indices
+ */
+template <class T>
+int localMaximaIndices(const T * upperLeft, const int stride, const int w, const int h,
+            const T threshold, int * indices) {
+    int n = 0;
+    for(int y = 1; y < h-1; ++y) {
+        const T * row = upperLeft + y*stride;
+        for(int x = 1; x < w-1; ++x) {
+            if(isLocalMaximum(row+x, stride, threshold)) {
+                indices[n++] = y*stride + x;
+            }
+        }
+    }
+    return n;
+}
+
+#ifdef __SSE2__
+// one row of pixels [x, end) with vectors of 4 pixels, the rest one by one
+STORM_ALWAYS_INLINE int localMaximaRowSSE(const float * row, const int stride, int x, const int end,
+            const float threshold, const int offset, int * indices, int n) {
+    const float * up = row - stride;
+    const float * down = row + stride;
+    const __m128 thr4 = _mm_set1_ps(threshold);
+    for(; x+4 <= end; x += 4) {
+        __m128 v = _mm_loadu_ps(row+x);
+        __m128 m = _mm_cmpgt_ps(v, thr4);
+        m = _mm_and_ps(m, _mm_cmpgt_ps(v, _mm_loadu_ps(row+x-1)));
+        m = _mm_and_ps(m, _mm_cmpgt_ps(v, _mm_loadu_ps(row+x+1)));
+        m = _mm_and_ps(m, _mm_cmpgt_ps(v, _mm_loadu_ps(up+x-1)));
+        m = _mm_and_ps(m, _mm_cmpgt_ps(v, _mm_loadu_ps(up+x)));
+        m = _mm_and_ps(m, _mm_cmpgt_ps(v, _mm_loadu_ps(up+x+1)));
+        m = _mm_and_ps(m, _mm_cmpgt_ps(v, _mm_loadu_ps(down+x-1)));
+        m = _mm_and_ps(m, _mm_cmpgt_ps(v, _mm_loadu_ps(down+x)));
+        m = _mm_and_ps(m, _mm_cmpgt_ps(v, _mm_loadu_ps(down+x+1)));
+        n = compactMask(_mm_movemask_ps(m), offset+x, indices, n);
+    }
+    for(; x < end; ++x) { // remaining pixels of the row
+        if(isLocalMaximum(row+x, stride, threshold)) {
+            indices[n++] = offset + x;
+        }
+    }
+    return n;
+}
+
+#if defined(__AVX__) || defined(STORM_MULTIVERSIONING)
+// same with vectors of 8 pixels, returns the first pixel that is left
+#ifndef __AVX__
+STORM_TARGET_AVX2
+#endif
+STORM_ALWAYS_INLINE int localMaximaRowAVX(const float * row, const int stride, int x, const int end,
+            const float threshold, const int offset, int * indices, int & n) {
+    const float * up = row - stride;
+    const float * down = row + stride;
+    const __m256 thr8 = _mm256_set1_ps(threshold);
+    for(; x+8 <= end; x += 8) {
+        __m256 v = _mm256_loadu_ps(row+x);
+        __m256 m = _mm256_cmp_ps(v, thr8, _CMP_GT_OQ);
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(row+x-1), _CMP_GT_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(row+x+1), _CMP_GT_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(up+x-1), _CMP_GT_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(up+x), _CMP_GT_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(up+x+1), _CMP_GT_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(down+x-1), _CMP_GT_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(down+x), _CMP_GT_OQ));
+        m = _mm256_and_ps(m, _mm256_cmp_ps(v, _mm256_loadu_ps(down+x+1), _CMP_GT_OQ));
+        n = compactMask(_mm256_movemask_ps(m), offset+x, indices, n);
+    }
+    return x;
+}
+#endif
+
+// baseline of the build: SSE2 (and AVX, if the compiler may use it)
+inline int localMaximaIndicesGeneric(const float * upperLeft, const int stride, const int w, const int h,
+            const float threshold, int * indices) {
+    int n = 0;
+    for(int y = 1; y < h-1; ++y) {
+        const float * row = upperLeft + y*stride;
+        int x = 1;
+#ifdef __AVX__
+        x = localMaximaRowAVX(row, stride, x, w-1, threshold, y*stride, indices, n);
+#endif // __AVX__
+        n = localMaximaRowSSE(row, stride, x, w-1, threshold, y*stride, indices, n);
+    }
+    return n;
+}
+
+#ifdef STORM_MULTIVERSIONING
+STORM_TARGET_AVX2
+inline int localMaximaIndicesAVX2(const float * upperLeft, const int stride, const int w, const int h,
+            const float threshold, int * indices) {
+    int n = 0;
+    for(int y = 1; y < h-1; ++y) {
+        const float * row = upperLeft + y*stride;
+        int x = localMaximaRowAVX(row, stride, 1, w-1, threshold, y*stride, indices, n);
+        n = localMaximaRowSSE(row, stride, x, w-1, threshold, y*stride, indices, n);
+    }
+    return n;
+}
+
+// vectors of 16 pixels, the comparisons give bit masks directly
+STORM_TARGET_AVX512
+inline int localMaximaIndicesAVX512(const float * upperLeft, const int stride, const int w, const int h,
+            const float threshold, int * indices) {
+    int n = 0;
+    const __m512 thr16 = _mm512_set1_ps(threshold);
+    for(int y = 1; y < h-1; ++y) {
+        const float * row = upperLeft + y*stride;
+        const float * up = row - stride;
+        const float * down = row + stride;
+        int x = 1;
+        for(; x+16 <= w-1; x += 16) {
+            __m512 v = _mm512_loadu_ps(row+x);
+            __mmask16 m = _mm512_cmp_ps_mask(v, thr16, _CMP_GT_OQ);
+            m = _mm512_mask_cmp_ps_mask(m, v, _mm512_loadu_ps(row+x-1), _CMP_GT_OQ);
+            m = _mm512_mask_cmp_ps_mask(m, v, _mm512_loadu_ps(row+x+1), _CMP_GT_OQ);
+            m = _mm512_mask_cmp_ps_mask(m, v, _mm512_loadu_ps(up+x-1), _CMP_GT_OQ);
+            m = _mm512_mask_cmp_ps_mask(m, v, _mm512_loadu_ps(up+x), _CMP_GT_OQ);
+            m = _mm512_mask_cmp_ps_mask(m, v, _mm512_loadu_ps(up+x+1), _CMP_GT_OQ);
+            m = _mm512_mask_cmp_ps_mask(m, v, _mm512_loadu_ps(down+x-1), _CMP_GT_OQ);
+            m = _mm512_mask_cmp_ps_mask(m, v, _mm512_loadu_ps(down+x), _CMP_GT_OQ);
+            m = _mm512_mask_cmp_ps_mask(m, v, _mm512_loadu_ps(down+x+1), _CMP_GT_OQ);
+            n = compactMask(m, y*stride+x, indices, n);
+        }
+        x = localMaximaRowAVX(row, stride, x, w-1, threshold, y*stride, indices, n);
+        n = localMaximaRowSSE(row, stride, x, w-1, threshold, y*stride, indices, n);
+    }
+    return n;
+}
+#endif // STORM_MULTIVERSIONING
+
+inline int localMaximaIndices(const float * upperLeft, const int stride, const int w, const int h,
+            const float threshold, int * indices) {
+#ifdef STORM_MULTIVERSIONING
+    switch(kernelPath(CPU_AVX512)) {
+        case CPU_AVX512:
+            return localMaximaIndicesAVX512(upperLeft, stride, w, h, threshold, indices);
+        case CPU_AVX2:
+            return localMaximaIndicesAVX2(upperLeft, stride, w, h, threshold, indices);
+        default:
+            break;
+    }
+#endif // STORM_MULTIVERSIONING
+    return localMaximaIndicesGeneric(upperLeft, stride, w, h, threshold, indices);
+}
+#endif // __SSE2__
+
+#endif // LOCALMAXIMA_H
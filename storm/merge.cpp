@@ -0,0 +1,282 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher and Ullrich Koethe      */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/************************************************************************/
+
+// Merge the shards of a run that was distributed over several processes.
+// Usage: storm-merge [Options] outfile.png shard1.txt [shard2.txt ...]
+// Every shard is the coordinate file of a run with --shard and its
+// accumulator file (same name, extension .acc). The coordinates are
+// merged in the order of the frames (the frame numbers are those of the
+// stack), the accumulators are summed to the result image. Both is done
+// in parallel.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <utility>
+#include <cstdio>
+#include "program_options_getopt.h"
+#include "wienerStorm.hxx"
+#include "configVersion.hxx"
+
+#include <vigra/impex.hxx>
+#include <vigra/timing.hxx>
+
+void printMergeUsage(const char* prog) {
+    std::cout << "Usage: " << prog << " [Options] outfile.png shard1.txt [shard2.txt ...]" << std::endl
+     << "Merge the coordinate files and result images of the shards of a run" << std::endl
+     << "(see storm --shard) into one coordinate file and one image." << std::endl
+     << "Allowed Options: " << std::endl
+     << "  --help           Print this help message" << std::endl
+     << "  -v or --verbose  verbose message output" << std::endl
+     << "  --coordsfile=Arg filename for the merged coordinates" << std::endl
+     << "                   (default: outfile.txt)" << std::endl
+     << "  --version        print version information and exit" << std::endl
+     ;
+}
+
+/**
+ * Frame number of a line of a coordinate file (x y frame ...), -1 if empty
+ */
+inline int frameOfLine(const std::string& line) {
+    int frame = -1;
+    if(std::sscanf(line.c_str(), "%*s %*s %d", &frame) != 1) {
+        return -1;
+    }
+    return frame;
+}
+
+/**
+ * Merge the coordinate files of the shards in the order of the frames,
+ * the lines are copied unchanged. The shards of a frame are taken in
+ * the order they are given.
+ * Returns the number of spots, -1 if a file could not be read or written.
+ */
+int mergeCoordsFiles(const std::vector<std::string>& shards, const std::string& coordsfile, std::string& error) {
+    typedef std::pair<int, int> Entry; // (frame of the next line, shard)
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+    std::vector<std::ifstream*> files(shards.size());
+    std::vector<std::string> lines(shards.size());
+    std::string header;
+    bool ok = true;
+    for(unsigned int s = 0; s < shards.size() && ok; ++s) {
+        files[s] = new std::ifstream(shards[s].c_str());
+        std::string h;
+        if(!std::getline(*files[s], h)) {
+            error = "Could not read the coordinate file " + shards[s] + ".";
+            ok = false;
+        } else if(s > 0 && h != header) {
+            error = "The shard " + shards[s] + " is from another stack than " + shards[0] + ".";
+            ok = false;
+        }
+        header = h;
+        while(ok && std::getline(*files[s], lines[s])) {
+            int frame = frameOfLine(lines[s]);
+            if(frame >= 0) {
+                queue.push(Entry(frame, s));
+                break;
+            }
+        }
+    }
+
+    int numSpots = 0;
+    std::ofstream out(coordsfile.c_str());
+    if(ok && !out.is_open()) {
+        error = "Could not open coordinate-file for writing.";
+        ok = false;
+    }
+    if(ok) {
+        out << header << std::endl;
+    }
+    while(ok && !queue.empty()) {
+        const int frame = queue.top().first;
+        const int s = queue.top().second;
+        queue.pop();
+        // all spots of the frame in this shard
+        out << lines[s] << std::endl;
+        ++numSpots;
+        while(std::getline(*files[s], lines[s])) {
+            const int next = frameOfLine(lines[s]);
+            if(next < 0) {
+                continue; // empty line
+            }
+            if(next != frame) {
+                queue.push(Entry(next, s));
+                break;
+            }
+            out << lines[s] << std::endl;
+            ++numSpots;
+        }
+    }
+    if(ok && !out) {
+        error = "Could not write the coordinate file.";
+        ok = false;
+    }
+    for(unsigned int s = 0; s < files.size(); ++s) {
+        delete files[s];
+    }
+    return ok ? numSpots : -1;
+}
+
+// MAIN
+int main(int argc, char** argv) {
+    std::string outfile, coordsfile;
+    std::vector<std::string> shards;
+    int verbose = 0;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"help",     no_argument, 0,  '?' },
+            {"verbose",     no_argument, 0,  'v' },
+            {"version",     no_argument, 0,  'V' },
+            {"coordsfile",    required_argument, 0,  'c'},
+            {0,         0,                 0,  0 }
+        };
+        int c = getopt_long(argc, argv, "?vVc:", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'c': // coordsfile
+            coordsfile = optarg;
+            break;
+        case 'v':
+            ++verbose;
+            break;
+        case 'V':
+            std::cout << "STORM analysis software version " << versionString() << std::endl;
+            return -1;
+        case '?':
+        default:
+            printMergeUsage(argv[0]);
+            return -1;
+        }
+    }
+    while (optind < argc) {
+        if(outfile == "") outfile = argv[optind++];
+        else shards.push_back(argv[optind++]);
+    }
+    if(shards.size() == 0) {
+        std::cerr << "error: no shards given" << std::endl;
+        printMergeUsage(argv[0]);
+        return -1;
+    }
+    if(coordsfile == "") {
+        coordsfile = outfile;
+        size_t pos = coordsfile.find_last_of('.');
+        if(pos != std::string::npos) {
+            coordsfile.replace(pos, 255, ".txt"); // replace extension
+        } else {
+            coordsfile += ".txt";
+        }
+    }
+
+    try
+    {
+        // all accumulators must be complete and of the same size
+        AccumulatorInfo info;
+        for(unsigned int s = 0; s < shards.size(); ++s) {
+            AccumulatorInfo si;
+            std::string msg = "Could not read the accumulator file of the shard " + shards[s] +
+                    ", the shard is not complete.";
+            vigra_precondition(loadAccumulatorInfo(accumulatorFilename(shards[s]), si), msg.c_str());
+            msg = "The shard " + shards[s] + " was run with another factor or on another stack.";
+            vigra_precondition(s == 0 || (si.factor == info.factor && si.width == info.width
+                        && si.height == info.height), msg.c_str());
+            info = si;
+        }
+        if(verbose) {
+            std::cout << "merging " << shards.size() << " shards, image size "
+                << info.width << "x" << info.height << std::endl;
+        }
+        // check if outfile is writable, otherwise throw error -> exit
+        DImage res(info.width, info.height);
+        exportImage(srcImageRange(res), ImageExportInfo(outfile.c_str()));
+
+        USETICTOC;
+        TIC;
+
+        // One thread merges the coordinates, the others sum the accumulators,
+        // each into its own image, the thread that is done with the
+        // coordinates joins them.
+        int threads = 1;
+        #ifdef OPENMP_FOUND
+        threads = omp_get_max_threads();
+        #endif //OPENMP_FOUND
+        std::vector<DImage> sums(threads);
+        int numSpots = 0, accSpots = 0;
+        std::string coordsError;
+        std::vector<char> accOk(shards.size(), 0);
+        #pragma omp parallel num_threads(threads)
+        {
+            int thread = 0;
+            #ifdef OPENMP_FOUND
+            thread = omp_get_thread_num();
+            #endif //OPENMP_FOUND
+            #pragma omp single nowait
+            {
+                numSpots = mergeCoordsFiles(shards, coordsfile, coordsError);
+            }
+            DImage acc(info.width, info.height);
+            #pragma omp for schedule(dynamic) reduction(+:accSpots) nowait
+            for(int s = 0; s < (int)shards.size(); ++s) {
+                AccumulatorInfo si;
+                if(!loadAccumulator(accumulatorFilename(shards[s]), si, acc)) {
+                    continue;
+                }
+                accOk[s] = 1;
+                accSpots += si.numSpots;
+                if(sums[thread].width() == 0) {
+                    sums[thread] = acc;
+                } else {
+                    combineTwoImages(srcImageRange(sums[thread]), srcImage(acc), destImage(sums[thread]),
+                            std::plus<double>());
+                }
+            }
+        }
+        vigra_postcondition(numSpots >= 0, coordsError.c_str());
+        for(unsigned int s = 0; s < shards.size(); ++s) {
+            std::string msg = "Could not read the accumulator file of the shard " + shards[s] + ".";
+            vigra_postcondition(accOk[s], msg.c_str());
+        }
+        if(numSpots != accSpots) {
+            std::cout << "warning: " << numSpots << " spots in the coordinate files, but "
+                << accSpots << " in the accumulators." << std::endl;
+        }
+
+        // sum the images of the threads, in parallel over the rows
+        #pragma omp parallel for
+        for(int y = 0; y < info.height; ++y) {
+            for(int x = 0; x < info.width; ++x) {
+                double v = 0.;
+                for(int t = 0; t < threads; ++t) {
+                    if(sums[t].width() != 0) {
+                        v += sums[t](x, y);
+                    }
+                }
+                res(x, y) = v;
+            }
+        }
+
+        TOC;
+        std::cout << "merged " << numSpots << " spots of " << shards.size() << " shards." << std::endl;
+        exportResultImage(res, outfile);
+    }
+    catch (vigra::StdException & e)
+    {
+        std::cout<<"There was an error:"<<std::endl;
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,321 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef NUMATOPOLOGY_H
+#define NUMATOPOLOGY_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#if defined(__linux__)
+    #include <sched.h>
+#elif defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#endif
+
+/*
+ * Placement of the frame threads on machines with several NUMA nodes
+ *
+ * Memory is placed on the node of the thread that first writes it
+ * (first touch), and every access from another socket is slower. 
+ * Without placement, the operating system moves the threads between
+ * the sockets, and the scaling flattens beyond one socket.
+ *
+ * The frame threads are therefore divided into one group per node
+ * (contiguous thread numbers, see ThreadPlacement), and every thread
+ * is bound to the CPUs of its node; the threads working within a frame
+ * inherit the binding. The read-only data of the frames (the filter) is
+ * replicated per node (NodeReplicas), the workspaces of the threads and
+ * the frame buffers are first written by a thread of the node that 
+ * uses them, and the FrameScheduler prefers the frames of the same node.
+ *
+ * The nodes are read from /sys/devices/system/node on Linux and with
+ * GetNumaNodeProcessorMask() on Windows (first processor group), only
+ * the CPUs the process may run on are used. With one node (or 
+ * STORM_NUMA=off in the environment) no thread is bound.
+ */
+
+/**
+ * Nodes and their CPUs
+ */
+class NumaTopology {
+public:
+    NumaTopology();
+
+    int nodes() const { return m_cpus.size(); }
+    const std::vector<int>& cpus(const int node) const { return m_cpus[node]; }
+
+    /**
+     * Bind the calling thread to the CPUs of node, or to the CPUs of
+     * all nodes for node = -1. Returns false if that is not possible.
+     */
+    bool bindThread(const int node) const;
+
+    void print(std::ostream& os) const;
+
+private:
+    // CPU numbers of a list like "0-3,8-11"
+    static std::vector<int> parseCpuList(const std::string& list);
+
+    std::vector<std::vector<int> > m_cpus; // per node, at least one node
+};
+
+/**
+ * The topology of this machine, detected at the first call
+ * (which must not be within a parallel region)
+ */
+inline const NumaTopology& numaTopology() {
+    static const NumaTopology topology;
+    return topology;
+}
+
+inline std::vector<int> NumaTopology::parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream is(list);
+    std::string range;
+    while(std::getline(is, range, ',')) {
+        if(range.find_first_of("0123456789") == std::string::npos) {
+            continue; // e.g. the end of line
+        }
+        const size_t dash = range.find('-');
+        const int first = std::atoi(range.c_str());
+        const int last = (dash == std::string::npos) ? first : std::atoi(range.c_str()+dash+1);
+        for(int c = first; c <= last; ++c) {
+            cpus.push_back(c);
+        }
+    }
+    return cpus;
+}
+
+inline NumaTopology::NumaTopology() {
+    const char * env = std::getenv("STORM_NUMA");
+    if(env == 0 || std::strcmp(env, "off") != 0) {
+        #if defined(__linux__)
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        const bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+        std::string online;
+        std::ifstream onlineFile("/sys/devices/system/node/online");
+        std::getline(onlineFile, online);
+        const std::vector<int> nodeIds = parseCpuList(online);
+        for(unsigned int n = 0; n < nodeIds.size(); ++n) {
+            std::ostringstream name;
+            name << "/sys/devices/system/node/node" << nodeIds[n] << "/cpulist";
+            std::ifstream f(name.str().c_str());
+            std::string list;
+            std::getline(f, list);
+            std::vector<int> all = parseCpuList(list), cpus;
+            for(unsigned int k = 0; k < all.size(); ++k) {
+                if(all[k] < CPU_SETSIZE && (!restricted || CPU_ISSET(all[k], &allowed))) {
+                    cpus.push_back(all[k]);
+                }
+            }
+            if(!cpus.empty()) { // nodes with memory only are skipped
+                m_cpus.push_back(cpus);
+            }
+        }
+        #elif defined(_WIN32)
+        ULONG highest = 0;
+        DWORD_PTR processMask = 0, systemMask = 0;
+        if(GetNumaHighestNodeNumber(&highest) && 
+                GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+            for(ULONG n = 0; n <= highest; ++n) {
+                ULONGLONG mask = 0;
+                std::vector<int> cpus;
+                if(GetNumaNodeProcessorMask((UCHAR)n, &mask)) {
+                    for(int c = 0; c < (int)(8*sizeof(DWORD_PTR)); ++c) {
+                        if((mask & processMask) & ((ULONGLONG)1 << c)) {
+                            cpus.push_back(c);
+                        }
+                    }
+                }
+                if(!cpus.empty()) {
+                    m_cpus.push_back(cpus);
+                }
+            }
+        }
+        #endif
+    }
+    if(m_cpus.size() < 2) { // nothing to place
+        m_cpus.assign(1, std::vector<int>());
+    }
+}
+
+inline bool NumaTopology::bindThread(const int node) const {
+    std::vector<int> cpus;
+    for(int n = 0; n < nodes(); ++n) {
+        if(node < 0 || node == n) {
+            cpus.insert(cpus.end(), m_cpus[n].begin(), m_cpus[n].end());
+        }
+    }
+    if(cpus.empty()) {
+        return false;
+    }
+    #if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(unsigned int k = 0; k < cpus.size(); ++k) {
+        CPU_SET(cpus[k], &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0; // the calling thread
+    #elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for(unsigned int k = 0; k < cpus.size(); ++k) {
+        mask |= (DWORD_PTR)1 << cpus[k];
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+    #else
+    return false;
+    #endif
+}
+
+inline void NumaTopology::print(std::ostream& os) const {
+    os << "numa: " << nodes() << (nodes() > 1 ? " nodes with " : " node");
+    for(int n = 0; n < nodes() && nodes() > 1; ++n) {
+        os << (n > 0 ? ", " : "") << cpus(n).size();
+    }
+    os << (nodes() > 1 ? " cpus" : "") << std::endl;
+}
+
+/**
+ * Assignment of the frame threads to the nodes: thread t of n runs on
+ * node t*nodes/n, i.e. the nodes get equal groups of consecutive threads.
+ * With fewer frame threads than nodes (e.g. one frame at a time, split
+ * over all CPUs), the threads are not bound.
+ */
+class ThreadPlacement {
+public:
+    ThreadPlacement(const NumaTopology& topology, const int threads)
+        : m_topology(topology), m_nodes(threads, 0),
+          m_active(topology.nodes() > 1 && threads >= topology.nodes()) {
+        for(int t = 0; t < threads && m_active; ++t) {
+            m_nodes[t] = t*topology.nodes()/threads;
+        }
+    }
+
+    // the threads are bound to their nodes
+    bool active() const { return m_active; }
+    int nodes() const { return m_active ? m_topology.nodes() : 1; }
+    int node(const int thread) const { return m_nodes[thread]; }
+    const std::vector<int>& nodeOfThreads() const { return m_nodes; }
+
+    // the first thread of its node, it makes the replicas for the node
+    bool leader(const int thread) const {
+        return thread == 0 || m_nodes[thread-1] != m_nodes[thread];
+    }
+
+    /**
+     * Bind the calling thread to the CPUs of the node of thread 
+     * (if there are several nodes)
+     */
+    void bind(const int thread) const {
+        if(m_active) {
+            m_topology.bindThread(m_nodes[thread]);
+        }
+    }
+
+    /**
+     * Let the calling thread run on all nodes again (e.g. the master
+     * thread and the thread pool after the frames are done)
+     */
+    void unbind() const {
+        if(m_active) {
+            m_topology.bindThread(-1);
+        }
+    }
+
+    void print(std::ostream& os) const {
+        m_topology.print(os);
+        if(m_active) {
+            os << "  frame threads per node:";
+            for(int n = 0; n < nodes(); ++n) {
+                os << " " << std::count(m_nodes.begin(), m_nodes.end(), n);
+            }
+            os << std::endl;
+        }
+    }
+
+private:
+    const NumaTopology& m_topology;
+    std::vector<int> m_nodes;
+    bool m_active;
+};
+
+/**
+ * Copies of read-only data, one per node (only with several nodes).
+ * A copy is made by a thread on its node and thus placed there.
+ */
+template <class Data>
+class NodeReplicas {
+public:
+    NodeReplicas(const Data& original, const int nodes)
+        : m_original(original), m_copies(nodes, (Data *)0) {  }
+    ~NodeReplicas() {
+        for(unsigned int n = 0; n < m_copies.size(); ++n) {
+            delete m_copies[n];
+        }
+    }
+
+    /**
+     * Copy the original, to be called by a thread bound to node
+     * (one per node)
+     */
+    void replicate(const int node) {
+        if(m_copies.size() > 1 && m_copies[node] == 0) {
+            m_copies[node] = new Data(m_original);
+        }
+    }
+
+    // the copy of node, or the original if there is none
+    const Data& local(const int node) const {
+        return m_copies[node] ? *m_copies[node] : m_original;
+    }
+
+private:
+    // not copyable
+    NodeReplicas(const NodeReplicas&);
+    NodeReplicas& operator=(const NodeReplicas&);
+
+    const Data& m_original;
+    std::vector<Data *> m_copies;
+};
+
+#endif // NUMATOPOLOGY_H
@@ -0,0 +1,102 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+#ifndef PEAKREFINEMENT_H
+#define PEAKREFINEMENT_H
+
+#include <cmath>
+#include <algorithm>
+
+/*
+ * Sub-pixel localization of a maximum without upsampling the ROI
+ *
+ * Starting at a maximum candidate (a local maximum of the pixel values),
+ * a few Newton steps are done on a continuous model of the image, e.g.
+ * a LocalSplineView of the filtered frame. The spline method
+ * samples the same function on a grid of 1/factor pixels, whereas here
+ * the maximum is found to (almost) arbitrary precision with some
+ * dozens of spline evaluations.
+ */
+
+/**
+ * Find the maximum of a continuous image model near (x, y).
+ *
+ * The search is restricted to the box of +-1 pixel around the start 
+ * position (and to the image). If the Hessian is not negative definite,
+ * a gradient step is done instead of a Newton step.
+ *
+ * @param view image model providing operator(), dx(), dy(), dxx(), dyy() and dxy()
+ * @param x, y start position; overwritten with the position of the maximum
+ * @return value of the model at the maximum
+ */
+template <class View>
+typename View::value_type refinePeakNewton(const View& view, double& x, double& y,
+            const int maxIterations=10, const double tolerance=1e-3) {
+    const double x0 = x, y0 = y;
+    const double xmin = std::max(x0-1., 0.), xmax = std::min(x0+1., view.width()-1.);
+    const double ymin = std::max(y0-1., 0.), ymax = std::min(y0+1., view.height()-1.);
+    const double maxStep = 0.5; // pixels
+
+    for(int i = 0; i < maxIterations; ++i) {
+        double gx = view.dx(x, y);
+        double gy = view.dy(x, y);
+        double hxx = view.dxx(x, y);
+        double hyy = view.dyy(x, y);
+        double hxy = view.dxy(x, y);
+        double det = hxx*hyy - hxy*hxy;
+        double sx, sy;
+        if(hxx < 0. && det > 0.) { // maximum: step = -H^-1 g
+            sx = -( hyy*gx - hxy*gy) / det;
+            sy = -(-hxy*gx + hxx*gy) / det;
+        } else { // no maximum in quadratic approximation: move uphill
+            double norm = std::sqrt(gx*gx + gy*gy);
+            if(norm == 0.) {
+                break;
+            }
+            sx = 0.25*gx/norm;
+            sy = 0.25*gy/norm;
+        }
+        double len = std::sqrt(sx*sx + sy*sy);
+        if(len > maxStep) {
+            sx *= maxStep/len;
+            sy *= maxStep/len;
+        }
+        x = std::min(std::max(x+sx, xmin), xmax);
+        y = std::min(std::max(y+sy, ymin), ymax);
+        if(len < tolerance) {
+            break;
+        }
+    }
+    return view(x, y);
+}
+
+#endif // PEAKREFINEMENT_H
@@ -32,8 +32,10 @@
 /************************************************************************/
 
 
+#include <algorithm>
 #include "program_options_getopt.h"
 #include "configVersion.hxx"
+#include "cpudispatch.hxx"
  
 inline double convertToDouble(const char* const s) {
    std::istringstream i(s);
@@ -47,7 +49,7 @@ void printUsage(const char* prog) {
 	std::cout << "Usage: " << prog << " [Options] infile.sif [outfile.png]" << std::endl 
 	 << "Allowed Options: " << std::endl 
 	 << "  --help           Print this help message" << std::endl 
-	 <<	"  -v or --verbose  verbose message output" << std::endl
+	 <<	"  -v or --verbose  verbose message output (twice: also per frame)" << std::endl
 	 << "  --factor=Arg     Resize factor equivalent to the subpixel-precision" << std::endl 
 	 << "  --threshold=Arg  Threshold for background suppression" << std::endl 
 	 << "  --coordsfile=Arg filename for output of the found Coordinates" << std::endl 
@@ -55,6 +57,26 @@ void printUsage(const char* prog) {
 	 << "                   does not exist, generate a new filter from the data" << std::endl
 	 << "  --roi-len=Arg    size of the roi around maxima candidates" << std::endl 
 	 << "  --frames=Arg     run only on a subset of the stack (frames=start:end)" << std::endl 
+	 << "  --method=Arg     sub-pixel localization: spline (default), fourier" << std::endl 
+	 << "                   (band-limited), newton (continuous refinement) or" << std::endl 
+	 << "                   mle (Gaussian fit, adds uncertainty to coordsfile) or" << std::endl 
+	 << "                   peak (spline, only around the candidate pixels) or" << std::endl 
+	 << "                   quicklook (3x3 parabola fit, fast preview)" << std::endl 
+	 << "  --background=Arg background estimation: spatial (default, per frame)" << std::endl 
+	 << "                   or temporal (rolling per-pixel model over the frames)" << std::endl 
+	 << "  --tile-size=Arg  process larger frames in tiles of Arg x Arg pixels" << std::endl 
+	 << "                   to bound the memory per thread (default: whole frame)" << std::endl 
+	 << "  --checkpoint=Arg write a checkpoint every Arg seconds to continue an" << std::endl 
+	 << "                   aborted run (default: 600, -1: no checkpoints)" << std::endl 
+	 << "  --resume         continue from the checkpoint of an aborted run" << std::endl 
+	 << "  --shard          process the frames as one part of a run that is" << std::endl 
+	 << "                   distributed over several processes: save coordsfile" << std::endl 
+	 << "                   (default for frames=200:500: infile_frames200-500.txt)" << std::endl 
+	 << "                   and result image (.acc) for storm-merge. The filter" << std::endl 
+	 << "                   must exist, see --make-filter" << std::endl 
+	 << "  --make-filter    generate the filter for the shards and exit" << std::endl 
+	 << "  --print-cpu-path print the code path (SIMD variant) of the kernels" << std::endl 
+	 << "                   on this CPU and exit" << std::endl 
 	 << "  --version        print version information and exit" << std::endl 
 	 ;
 }
@@ -67,6 +89,7 @@ void setDefaults(std::map<char,double>& params, std::map<char,std::string>&files
     params['g']	= (params['g']==0)?8:params['g']; // factor
     params['t']	= (params['t']==0)?250:params['t']; // threshold
     params['m']	= (params['m']==0)?9:params['m']; // roi-len
+    params['C']	= (params['C']==0)?600:params['C']; // checkpoint interval
     
     
     // defaults: save out- and coordsfile into the same folder as input stack
@@ -77,7 +100,14 @@ void setDefaults(std::map<char,double>& params, std::map<char,std::string>&files
 	}
     if(files['c']=="") {
 		files['c'] = files['i'];
-		files['c'].replace(pos, 255, ".txt"); // replace extension
+		if(params['S'] > 0) {
+			// one file per shard, named by its frames
+			std::string range = (files['F']=="") ? "all" : files['F'];
+			std::replace(range.begin(), range.end(), ':', '-');
+			files['c'].replace(pos, 255, "_frames" + range + ".txt");
+		} else {
+			files['c'].replace(pos, 255, ".txt"); // replace extension
+		}
 	}
     if(files['f']=="") {
 		files['f'] = files['i'];
@@ -107,12 +137,20 @@ int parseProgramOptions(int argc, char **argv, std::map<char,double>& params, st
 			{"filter",    required_argument, 0,  'f' },
 			{"roi-len",    required_argument, 0,  'm' },
 			{"frames",    required_argument, 0,  'F' },
+			{"method",    required_argument, 0,  'M' },
+			{"background",    required_argument, 0,  'B' },
+			{"tile-size",    required_argument, 0,  'T' },
+			{"print-cpu-path",    no_argument, 0,  'P' },
+			{"checkpoint",    required_argument, 0,  'C' },
+			{"resume",    no_argument, 0,  'R' },
+			{"shard",    no_argument, 0,  'S' },
+			{"make-filter",    no_argument, 0,  'W' },
 			{0,         0,                 0,  0 }
 
 		};
 
 		// valid options: "vc:" => -v option without parameter, c flag requires parameter
-		c = getopt_long(argc, argv, "?vVt:c:f:F:",
+		c = getopt_long(argc, argv, "?vVt:c:f:F:M:B:T:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -121,17 +159,27 @@ int parseProgramOptions(int argc, char **argv, std::map<char,double>& params, st
 		case 't': // threshold
 		case 'g': // factor
 		case 'm': // roi-len
+		case 'T': // tile-size
+		case 'C': // checkpoint
 			params[c] = convertToDouble(optarg);
 			break;
 			
 		case 'c': // coordsfile
 		case 'f': // filter
 		case 'F': // frames
+		case 'M': // method
+		case 'B': // background
 			files[c] = optarg;
 			break;
 
 		case 'v':
-			params['v'] = 1; // verbose mode
+			params['v'] += 1; // verbose mode, -vv: also per frame
+			break;
+
+		case 'R': // resume (no short option)
+		case 'S': // shard (no short option)
+		case 'W': // make-filter (no short option)
+			params[c] = 1;
 			break;
 			
 		// Option -? and in case of unknown option or missing argument
@@ -149,6 +197,11 @@ int parseProgramOptions(int argc, char **argv, std::map<char,double>& params, st
 			return -1;
 			break;
 
+		case 'P': // print-cpu-path (no short option)
+			printCpuPath(std::cout);
+			return -1;
+			break;
+
 		default:
 			std::cout << "?? getopt returned character code 0%o ??\n" << std::endl;
 		}
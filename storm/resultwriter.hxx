@@ -0,0 +1,439 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef RESULTWRITER_H
+#define RESULTWRITER_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <ctime>
+#include <vigra/error.hxx>
+#include <vigra/multi_array.hxx>
+#include "checkpoint.hxx"
+#include "framescheduler.hxx"
+
+/*
+ * Output of the localized spots
+ *
+ * The threads finish the frames roughly, but not exactly, in the order 
+ * of the stack. An OrderedFrameWriter takes them over in a window of 
+ * frames (a thread hands its frame over without a lock) and passes 
+ * them on to a FrameSink in the order of the stack, from whichever 
+ * thread completes the next frame in order.
+ *
+ * The StreamingCoordsWriter appends every frame to the coordinate file
+ * and draws it into the result image as soon as it is passed on. The
+ * memory for the spots is thus bounded by the window instead of growing
+ * with the stack, and the coordinates of the frames done are on disk.
+ * It also writes the checkpoints of a run and resumes from them.
+ *
+ * A shard (a run on a part of the frames, see storm --shard) saves its
+ * result image unclipped as accumulator file next to its coordinate
+ * file, storm-merge sums the accumulators of all shards.
+ */
+
+using namespace vigra; // for now
+
+/**
+ *  Draw coordinates detected in one frame into the resulting image
+ */
+template <class C, class Image>
+void drawCoordsToImage(const std::vector<C>& coords, Image& res) {
+    //  loop over the coordinates
+    typename std::vector<C>::const_iterator it2;
+
+    for(it2 = coords.begin(); it2 != coords.end(); it2++) {
+        const C& c = *it2;
+        res((int)(c.x+0.5), (int)(c.y+0.5)) += c.val;
+    }
+}
+
+/**
+ * Draw coordinates from all frames into the result image
+ */
+template <class C, class Image>
+void drawCoordsToImage(const std::vector<std::vector<C> >& coords, Image& res) {
+    res = 0;
+    typename std::vector<std::vector<C> >::const_iterator it;
+    //  loop over the images
+    for(it = coords.begin(); it != coords.end(); ++it) {
+        drawCoordsToImage( *it, res);
+    }
+}
+
+/**
+ * First line of a coordinate file: the shape of the stack
+ */
+inline void writeCoordsHeader(std::ostream& os, const MultiArrayShape<3>::type & shape) {
+    os << shape[0] << " " << shape[1] << " " << shape[2] << std::endl;
+    os << std::fixed; // fixed instead of scientific format
+}
+
+/**
+ * Write the coordinates of one frame, one spot per line:
+ * x y frame intensity asymmetry [uncertainty]
+ */
+template <class C>
+int writeFrameCoords(std::ostream& os, const std::vector<C>& coords, const unsigned int frame,
+            const int factor, const bool withUncertainty=false) {
+    typename std::vector<C>::const_iterator it2;
+    for(it2=coords.begin(); it2 != coords.end(); it2++) {
+        const C& c = *it2;
+        os << std::setprecision(3) << (float)c.x/factor << " " << (float)c.y/factor << " "
+            << frame << " " << std::setprecision(1) << c.val << " " << std::setprecision(3) << c.asymmetry;
+        if(withUncertainty) {
+            os << " " << c.uncertainty;
+        }
+        os << std::endl;
+    }
+    return coords.size();
+}
+
+/**
+ * Write all coordinates to a text file, one spot per line:
+ * x y frame intensity asymmetry [uncertainty]
+ */
+template <class C>
+int saveCoordsFile(const std::string& filename, const std::vector<std::vector<C> >& coords, 
+            const MultiArrayShape<3>::type & shape, const int factor, const bool withUncertainty=false) {
+    int numSpots = 0;
+    std::ofstream cfile (filename.c_str());
+    writeCoordsHeader(cfile, shape);
+    for(unsigned int j = 0; j < coords.size(); j++) {
+        numSpots += writeFrameCoords(cfile, coords[j], j, factor, withUncertainty);
+    }
+    cfile.close();
+    return numSpots;
+}
+
+/**
+ * Receiver of the spots of the frames, in the order of the stack
+ */
+template <class C>
+class FrameSink {
+public:
+    virtual ~FrameSink() {  }
+    // the spots of frame, coords may be swapped out
+    virtual void write(const int frame, std::vector<C>& coords) = 0;
+};
+
+/**
+ * Keep the spots of all frames in memory
+ */
+template <class C>
+class CoordsCollector : public FrameSink<C> {
+public:
+    CoordsCollector(std::vector<std::vector<C> >& coords) : m_coords(coords) {  }
+    virtual void write(const int frame, std::vector<C>& coords) {
+        m_coords[frame].swap(coords);
+    }
+private:
+    std::vector<std::vector<C> >& m_coords;
+};
+
+/**
+ * Append the spots to a coordinate file (unless the filename is empty)
+ * and draw them into the result image (of size factor*(w-1)+1 x factor*(h-1)+1)
+ *
+ * If resume is given, the coordinate file is cut after the frames of 
+ * the checkpoint and continued, and res has to contain the image of the checkpoint
+ * (see loadCheckpoint()). Cutting copies the coordinate file up to the
+ * checkpoint once (see truncateFile()).
+ *
+ * A checkpoint writes the whole result image, 8 bytes per pixel of the
+ * upsampled frame (e.g. 33 MB for 256x256 pixels and factor 8). It is
+ * written from write(), i.e. while the OrderedFrameWriter holds its 
+ * lock: no frame is passed on meanwhile, the threads go on with their
+ * frames until the buffer slots run out.
+ */
+template <class C, class Image>
+class StreamingCoordsWriter : public FrameSink<C> {
+public:
+    StreamingCoordsWriter(const std::string& coordsfile, const MultiArrayShape<3>::type & shape,
+                const int factor, const bool withUncertainty, Image& res, 
+                const Checkpoint * resume=0)
+        : m_factor(factor), m_withUncertainty(withUncertainty), m_numSpots(0), m_res(res),
+          m_interval(0), m_fingerprint(0), m_lastCheckpoint(0) {
+        if(resume) {
+            m_numSpots = resume->numSpots;
+        }
+        if(coordsfile != "") {
+            if(resume) {
+                vigra_precondition(truncateFile(coordsfile, resume->coordsBytes), 
+                        "Could not cut the coordinate-file to the frames of the checkpoint.");
+                m_file.open(coordsfile.c_str(), std::ios::in | std::ios::out);
+                m_file.seekp(resume->coordsBytes);
+            } else {
+                m_file.open(coordsfile.c_str(), std::ios::out | std::ios::trunc);
+            }
+            vigra_precondition(m_file.is_open() && m_file.good(), "Could not open coordinate-file for writing.");
+            if(resume) {
+                m_file << std::fixed;
+            } else {
+                writeCoordsHeader(m_file, shape);
+            }
+        }
+    }
+    virtual void write(const int frame, std::vector<C>& coords) {
+        if(m_file.is_open()) {
+            writeFrameCoords(m_file, coords, frame, m_factor, m_withUncertainty);
+        }
+        drawCoordsToImage(coords, m_res);
+        m_numSpots += coords.size();
+        if(m_interval > 0 && std::difftime(std::time(0), m_lastCheckpoint) >= m_interval) {
+            checkpoint(frame+1);
+        }
+    }
+    int numSpots() const { return m_numSpots; }
+
+    /**
+     * Write a checkpoint to filename at least every interval seconds
+     * (and after the first frame written after that time).
+     */
+    void setCheckpoints(const std::string& filename, const unsigned int fingerprint, const int interval) {
+        m_checkpointFile = filename;
+        m_fingerprint = fingerprint;
+        m_interval = interval;
+        m_lastCheckpoint = std::time(0);
+    }
+
+    /**
+     * Write a checkpoint now, all frames before done are written.
+     * If the file cannot be written, a warning is printed and false 
+     * returned, the run goes on and the next checkpoint is tried after
+     * the interval.
+     */
+    bool checkpoint(const int done) {
+        Checkpoint cp;
+        cp.done = done;
+        cp.numSpots = m_numSpots;
+        cp.fingerprint = m_fingerprint;
+        if(m_file.is_open()) {
+            m_file.flush();
+            cp.coordsBytes = m_file.tellp();
+        }
+        // this runs in the parallel region, an exception would terminate the run
+        const bool saved = saveCheckpoint(m_checkpointFile, cp, m_res);
+        if(!saved) {
+            std::cout << "warning: could not write the checkpoint file " << m_checkpointFile 
+                << ", trying again in " << m_interval << " s" << std::endl;
+        }
+        m_lastCheckpoint = std::time(0);
+        return saved;
+    }
+private:
+    std::fstream m_file;
+    int m_factor;
+    bool m_withUncertainty;
+    int m_numSpots;
+    Image& m_res;
+    std::string m_checkpointFile;
+    int m_interval;
+    unsigned int m_fingerprint;
+    std::time_t m_lastCheckpoint;
+};
+
+/**
+ * Pass the frames beg, beg+stride, ... < end on to a FrameSink in this 
+ * order, while they are completed in any order by the threads of a 
+ * FrameScheduler. A frame keeps its buffer slot of the scheduler 
+ * until it is written, so that the frames in flight (and the window) 
+ * are bounded by scheduler.slots().
+ */
+template <class C>
+class OrderedFrameWriter {
+public:
+    OrderedFrameWriter(FrameSink<C>& sink, FrameScheduler& scheduler,
+                const int beg, const int end, const int stride=1)
+        : m_sink(sink), m_scheduler(scheduler), m_beg(beg), m_stride(stride),
+          m_count(end > beg ? (end-beg+stride-1)/stride : 0), m_next(0),
+          m_window(scheduler.slots()) {  }
+
+    /**
+     * Hand over the spots of frame (swapped out, coords is empty
+     * afterwards) with the buffer slot of the frame. The frames 
+     * that are complete in order are written right away.
+     */
+    void submit(const int frame, std::vector<C>& coords, const int slot);
+
+    /**
+     * Write the remaining frames, after all frames were submitted
+     */
+    void finish();
+
+private:
+    class Entry {
+    public:
+        Entry() : ready(0), slot(-1) {  }
+        int ready; // set (with a flush) by the submitting thread
+        int slot;
+        std::vector<C> coords;
+    };
+
+    // not copyable
+    OrderedFrameWriter(const OrderedFrameWriter&);
+    OrderedFrameWriter& operator=(const OrderedFrameWriter&);
+
+    void drain();
+
+    FrameSink<C>& m_sink;
+    FrameScheduler& m_scheduler;
+    int m_beg, m_stride, m_count;
+    int m_next; // position of the next frame to write, guarded by m_lock
+    std::vector<Entry> m_window;
+    SchedulerLock m_lock;
+};
+
+template <class C>
+void OrderedFrameWriter<C>::submit(const int frame, std::vector<C>& coords, const int slot) {
+    const int pos = (frame-m_beg)/m_stride;
+    // the frames in flight hold distinct slots, thus pos < m_next + m_window.size()
+    Entry& entry = m_window[pos % m_window.size()];
+    entry.coords.swap(coords);
+    coords.clear();
+    entry.slot = slot;
+    #pragma omp flush
+    entry.ready = 1;
+    #pragma omp flush
+    drain();
+}
+
+template <class C>
+void OrderedFrameWriter<C>::drain() {
+    // whoever gets the lock writes, the others go on with their frames
+    while(m_lock.test()) {
+        for(;;) {
+            Entry& entry = m_window[m_next % m_window.size()];
+            #pragma omp flush
+            if(m_next >= m_count || !entry.ready) {
+                break;
+            }
+            m_sink.write(m_beg + m_next*m_stride, entry.coords);
+            entry.coords.clear();
+            entry.ready = 0;
+            #pragma omp flush
+            m_scheduler.release(entry.slot);
+            ++m_next;
+        }
+        const int next = m_next;
+        m_lock.unset();
+        // the next frame may have been handed over after the check above
+        #pragma omp flush
+        if(next >= m_count || !m_window[next % m_window.size()].ready) {
+            break;
+        }
+    }
+}
+
+template <class C>
+void OrderedFrameWriter<C>::finish() {
+    drain();
+    vigra_postcondition(m_next == m_count, "OrderedFrameWriter::finish(): frames are missing.");
+}
+
+/**
+ * Header of an accumulator file: the result image of a shard
+ */
+class AccumulatorInfo {
+public:
+    AccumulatorInfo() : numSpots(0), factor(0), width(0), height(0) {  }
+    int numSpots; // spots drawn into the image
+    int factor;   // resize factor of the run
+    int width, height;
+};
+
+/**
+ * The accumulator file belongs to the coordinate file of a shard: 
+ * same name, extension .acc
+ */
+inline std::string accumulatorFilename(const std::string& coordsfile) {
+    std::string accfile = coordsfile;
+    size_t pos = accfile.find_last_of('.');
+    size_t dir = accfile.find_last_of("/\\");
+    if(pos != std::string::npos && (dir == std::string::npos || pos > dir)) {
+        accfile.erase(pos);
+    }
+    return accfile + ".acc";
+}
+
+/**
+ * Save the (unclipped) result image of a shard.
+ * Returns false if the file could not be written.
+ */
+template <class Image>
+bool saveAccumulator(const std::string& filename, const Image& res, const int numSpots, const int factor) {
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    f << "storm-accumulator 1\n" 
+      << numSpots << " " << factor << " " << res.width() << " " << res.height() << "\n";
+    f.write((const char *)res.data(), sizeof(typename Image::value_type)*res.width()*res.height());
+    return !f.fail();
+}
+
+/**
+ * Read the header of an accumulator file, the stream is left at the image data
+ */
+inline bool readAccumulatorInfo(std::istream& f, AccumulatorInfo& info) {
+    std::string magic;
+    int version = 0;
+    f >> magic >> version;
+    if(!f || magic != "storm-accumulator" || version != 1) {
+        return false;
+    }
+    f >> info.numSpots >> info.factor >> info.width >> info.height;
+    f.get(); // end of line
+    return !f.fail();
+}
+
+inline bool loadAccumulatorInfo(const std::string& filename, AccumulatorInfo& info) {
+    std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+    return readAccumulatorInfo(f, info);
+}
+
+/**
+ * Read the result image of a shard, res must have the size of the image in the file.
+ * Returns false if the file could not be read or does not match.
+ */
+template <class Image>
+bool loadAccumulator(const std::string& filename, AccumulatorInfo& info, Image& res) {
+    std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+    if(!readAccumulatorInfo(f, info) || info.width != res.width() || info.height != res.height()) {
+        return false;
+    }
+    f.read((char *)res.data(), sizeof(typename Image::value_type)*res.width()*res.height());
+    return !f.fail();
+}
+
+#endif // RESULTWRITER_H
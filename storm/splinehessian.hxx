@@ -0,0 +1,295 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef SPLINEHESSIAN_H
+#define SPLINEHESSIAN_H
+
+#include <vector>
+#include <cmath>
+#include <vigra/error.hxx>
+#include <vigra/utilities.hxx>
+#include "cpudispatch.hxx"
+
+/*
+ * Second derivatives of the cubic B-spline of an image at a batch of
+ * sub-pixel positions.
+ *
+ * The values are the same as those of
+ *   vigra::SplineImageView<3,T>(..., true).dxx(), dyy() and dxy()
+ * (i.e. without prefiltering), but instead of copying the whole image
+ * into a SplineImageView, only the 4x4 neighbourhood of every position
+ * is collected (mirrored at the image border like in SplineImageView).
+ * The kernel weights and the convolutions are then computed for all
+ * positions at once, in loops over contiguous arrays that the compiler
+ * can vectorize (for each CpuPath). The weights are evaluated and
+ * summed in the same order and precision as in SplineImageView.
+ */
+
+using namespace vigra; // for now
+
+/**
+ * Derivative of order d (0, 1 or 2) of the cubic B-spline, as vigra::BSpline<3,double>
+ */
+STORM_ALWAYS_INLINE double cubicBSpline(double t, const int d) {
+    const double s = t < 0.0 ? -1.0 : 1.0;
+    t = std::fabs(t);
+    switch(d) {
+        case 0:
+            return t < 1.0 ? 2.0/3.0 + t*t*(-1.0 + 0.5*t)
+                 : t < 2.0 ? (2.0-t)*(2.0-t)*(2.0-t)/6.0
+                 : 0.0;
+        case 1:
+            return t < 1.0 ? s*t*(-2.0 + 1.5*t)
+                 : t < 2.0 ? -0.5*s*(2.0-t)*(2.0-t)
+                 : 0.0;
+        default:
+            return t < 1.0 ? 3.0*t - 2.0
+                 : t < 2.0 ? 2.0 - t
+                 : 0.0;
+    }
+}
+
+/**
+ * Index m of a line of length len, mirrored at the border like in SplineImageView
+ */
+inline int mirrorIndex(const int m, const int len) {
+    return (m < 0) ? -m : (m >= len) ? 2*len-2-m : m;
+}
+
+template <class T>
+class SplineHessian {
+public:
+    typedef T value_type;
+
+    SplineHessian() : m_n(0) {  }
+
+    /**
+     * Remove all positions (the memory is kept for the next batch)
+     */
+    void clear();
+
+    /**
+     * Add the position (x, y) of the image [srcUpperLeft, srcLowerRight).
+     */
+    template <class SrcIterator, class SrcAccessor>
+    void addPoint(SrcIterator srcUpperLeft, SrcIterator srcLowerRight, SrcAccessor sa,
+                  const double x, const double y);
+
+    /**
+     * Calculate the derivatives at all positions added since clear()
+     */
+    void compute();
+
+    int size() const { return m_n; }
+    T dxx(const int i) const { return m_dxx[i]; }
+    T dyy(const int i) const { return m_dyy[i]; }
+    T dxy(const int i) const { return m_dxy[i]; }
+
+private:
+    // weights of the 4 taps for offset u (SplineImageView::derivCoefficients())
+    static void coefficients(const std::vector<double>& u, const int d, std::vector<double> * c);
+    // sum_j ky[j] * sum_i kx[i] * patch(i,j) in the order of SplineImageView::convolve()
+    void convolve(const std::vector<double> * kx, const std::vector<double> * ky, std::vector<T>& res);
+    // weights and convolutions of compute(), and their variants
+    void computeDerivatives();
+    STORM_TARGET_AVX2 void computeDerivativesAVX2() { computeDerivatives(); }
+    STORM_TARGET_AVX512 void computeDerivativesAVX512() { computeDerivatives(); }
+
+    int m_n;
+    std::vector<T> m_patch[16]; // m_patch[4*j+i][n]: pixel (i,j) of the 4x4 neighbourhood
+    std::vector<double> m_u, m_v; // offset to the second tap
+    std::vector<double> m_kx[3], m_ky[3]; // weights of derivative d: m_kx[d][4*n+i]
+    std::vector<T> m_dxx, m_dyy, m_dxy;
+};
+
+template <class T>
+void SplineHessian<T>::clear() {
+    m_n = 0;
+    for(int k = 0; k < 16; ++k) {
+        m_patch[k].clear();
+    }
+    m_u.clear();
+    m_v.clear();
+}
+
+template <class T>
+template <class SrcIterator, class SrcAccessor>
+void SplineHessian<T>::addPoint(SrcIterator srcUpperLeft, SrcIterator srcLowerRight, SrcAccessor sa,
+                  const double x, const double y) {
+    const int w = srcLowerRight.x - srcUpperLeft.x;
+    const int h = srcLowerRight.y - srcUpperLeft.y;
+    // same range as SplineImageView::isValid()
+    vigra_precondition(x > 3.-w && x < 2.*w-4. && y > 3.-h && y < 2.*h-4.,
+        "SplineHessian::addPoint(): coordinates out of range.");
+    const int xCenter = (int)std::floor(x);
+    const int yCenter = (int)std::floor(y);
+    for(int j = 0; j < 4; ++j) {
+        const int iy = mirrorIndex(yCenter-1+j, h);
+        for(int i = 0; i < 4; ++i) {
+            const int ix = mirrorIndex(xCenter-1+i, w);
+            m_patch[4*j+i].push_back(sa(srcUpperLeft, Diff2D(ix, iy)));
+        }
+    }
+    m_u.push_back(x - xCenter);
+    m_v.push_back(y - yCenter);
+    ++m_n;
+}
+
+template <class T>
+STORM_ALWAYS_INLINE void SplineHessian<T>::coefficients(const std::vector<double>& u, const int d, std::vector<double> * c) {
+    const int n = u.size();
+    c[d].resize(4*n);
+    double * cd = &c[d][0];
+    for(int i = 0; i < 4; ++i) {
+        for(int k = 0; k < n; ++k) {
+            cd[i*n+k] = cubicBSpline(u[k] + 1.0 - i, d);
+        }
+    }
+}
+
+template <class T>
+STORM_ALWAYS_INLINE void SplineHessian<T>::convolve(const std::vector<double> * kx, const std::vector<double> * ky, std::vector<T>& res) {
+    const int n = m_n;
+    res.assign(n, T());
+    for(int j = 0; j < 4; ++j) {
+        const double * wy = &(*ky)[j*n];
+        const T * p0 = &m_patch[4*j][0];
+        const T * p1 = &m_patch[4*j+1][0];
+        const T * p2 = &m_patch[4*j+2][0];
+        const T * p3 = &m_patch[4*j+3][0];
+        const double * w0 = &(*kx)[0];
+        const double * w1 = &(*kx)[n];
+        const double * w2 = &(*kx)[2*n];
+        const double * w3 = &(*kx)[3*n];
+        for(int k = 0; k < n; ++k) {
+            T row = T(w3[k]*p3[k]) + (T(w2[k]*p2[k]) + (T(w1[k]*p1[k]) + T(w0[k]*p0[k])));
+            res[k] = (j == 0) ? T(wy[k]*row) : T(res[k] + T(wy[k]*row));
+        }
+    }
+}
+
+template <class T>
+void SplineHessian<T>::compute() {
+    if(m_n == 0) {
+        return;
+    }
+    switch(kernelPath(CPU_AVX512)) {
+        case CPU_AVX512:
+            computeDerivativesAVX512();
+            break;
+        case CPU_AVX2:
+            computeDerivativesAVX2();
+            break;
+        default:
+            computeDerivatives();
+    }
+}
+
+template <class T>
+STORM_ALWAYS_INLINE void SplineHessian<T>::computeDerivatives() {
+    for(int d = 0; d < 3; ++d) {
+        coefficients(m_u, d, m_kx);
+        coefficients(m_v, d, m_ky);
+    }
+    convolve(&m_kx[2], &m_ky[0], m_dxx);
+    convolve(&m_kx[0], &m_ky[2], m_dyy);
+    convolve(&m_kx[1], &m_ky[1], m_dxy);
+}
+
+/*
+ * The (not prefiltered) cubic spline of an image and its derivatives 
+ * at single sub-pixel positions.
+ *
+ * The values are the same as those of vigra::SplineImageView<3,T>(..., true),
+ * but every call only reads the 4x4 neighbourhood of the position 
+ * (mirrored at the image border), so nothing is copied or allocated. 
+ * This is meant for a few evaluations around a spot, e.g. the Newton 
+ * steps of refinePeakNewton(), where a SplineImageView would copy the 
+ * whole frame.
+ */
+template <class Image>
+class LocalSplineView {
+public:
+    typedef typename Image::value_type value_type;
+
+    LocalSplineView(const Image& image) : m_image(image) {  }
+
+    int width() const { return m_image.width(); }
+    int height() const { return m_image.height(); }
+
+    value_type operator()(const double x, const double y) const { return convolve(x, y, 0, 0); }
+    value_type dx(const double x, const double y) const { return convolve(x, y, 1, 0); }
+    value_type dy(const double x, const double y) const { return convolve(x, y, 0, 1); }
+    value_type dxx(const double x, const double y) const { return convolve(x, y, 2, 0); }
+    value_type dyy(const double x, const double y) const { return convolve(x, y, 0, 2); }
+    value_type dxy(const double x, const double y) const { return convolve(x, y, 1, 1); }
+
+private:
+    // derivative of order (dx, dy), summed in the order of SplineHessian::convolve()
+    value_type convolve(const double x, const double y, const int dx, const int dy) const;
+
+    const Image& m_image;
+};
+
+template <class Image>
+typename LocalSplineView<Image>::value_type 
+LocalSplineView<Image>::convolve(const double x, const double y, const int dx, const int dy) const {
+    typedef value_type T;
+    const int w = width();
+    const int h = height();
+    vigra_precondition(x > 3.-w && x < 2.*w-4. && y > 3.-h && y < 2.*h-4.,
+        "LocalSplineView: coordinates out of range.");
+    const int xCenter = (int)std::floor(x);
+    const int yCenter = (int)std::floor(y);
+    const double u = x - xCenter;
+    const double v = y - yCenter;
+    int ix[4];
+    double kx[4];
+    for(int i = 0; i < 4; ++i) {
+        ix[i] = mirrorIndex(xCenter-1+i, w);
+        kx[i] = cubicBSpline(u + 1.0 - i, dx);
+    }
+    T res = T();
+    for(int j = 0; j < 4; ++j) {
+        const int iy = mirrorIndex(yCenter-1+j, h);
+        const double ky = cubicBSpline(v + 1.0 - j, dy);
+        T row = T(kx[0]*m_image(ix[0], iy));
+        for(int i = 1; i < 4; ++i) {
+            row = T(kx[i]*m_image(ix[i], iy)) + row;
+        }
+        res = (j == 0) ? T(ky*row) : T(res + T(ky*row));
+    }
+    return res;
+}
+
+#endif // SPLINEHESSIAN_H
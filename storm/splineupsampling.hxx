@@ -0,0 +1,385 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef SPLINEUPSAMPLING_H
+#define SPLINEUPSAMPLING_H
+
+#include <vector>
+#include <algorithm>
+#include <vigra/error.hxx>
+#include <vigra/utilities.hxx>
+#include <vigra/rational.hxx>
+#include <vigra/separableconvolution.hxx>
+#include <vigra/splines.hxx>
+#include <vigra/resampling_convolution.hxx>
+#include "cpudispatch.hxx"
+
+/*
+ * Upsampling of small image regions by an integer factor with 
+ * precomputed polyphase B-spline kernels.
+ *
+ * vigra::resizeImageSplineInterpolation() creates the resampling kernels
+ * for every call, i.e. for every ROI. Since the factor is fixed, the
+ * kernels repeat with period factor and can be computed once.
+ * The kernels are created with vigra::createResamplingKernels() and the
+ * sums are accumulated in the same order and precision as
+ * vigra::resamplingConvolveLine(), so the result is identical to
+ * resizeImageSplineInterpolation() for prefiltered (or not to be
+ * prefiltered, see BSplineWOPrefilter) data. For factor 2, vigra sums 
+ * in double instead (vigra::resamplingExpandLine2()), and so does the
+ * instance of the kernel for this factor.
+ *
+ * The vertical pass is done row by row such that the inner loop
+ * runs over contiguous pixels and can be vectorized.
+ *
+ * All phases are padded with zero weights to the same number of taps,
+ * which does not change the sums. For the common settings (cubic spline,
+ * factor 4, 8 or 16), upsample() dispatches to instances of the kernel
+ * with the factor and the number of taps as compile-time constants, so
+ * that the phase computations are strength-reduced and the tap loops 
+ * unrolled. Other settings use the same kernel with runtime values.
+ * Every instance is compiled for each CpuPath (interpolatePath()).
+ */
+
+using namespace vigra; // for now
+
+/**
+ * Type of the sums of the kernel for FACTOR (T, or double for factor 2)
+ */
+template <int FACTOR, class T>
+struct UpsamplingSum {
+    typedef T type;
+};
+
+template <class T>
+struct UpsamplingSum<2, T> {
+    typedef double type;
+};
+
+/**
+ * BSpline coefficients but no prefiltering
+ */
+template <int ORDER, class T>
+class BSplineWOPrefilter
+ : public BSpline<ORDER, T> {
+
+    public:
+    /** Prefilter coefficients
+        (array has zero length, since image is already prefiltered).
+    */
+    ArrayVector<double> const & prefilterCoefficients() const
+    {
+        static ArrayVector<double> b;
+        return b;
+    }
+};
+
+template <class T>
+class SplineUpsampling {
+public:
+    typedef T value_type;
+
+    SplineUpsampling() : m_factor(0) {  }
+
+    /**
+     * Precompute the kernels of spline for all phases of factor.
+     * The spline must not need prefiltering (e.g. BSplineWOPrefilter).
+     */
+    template <class SPLINE>
+    void init(const SPLINE& spline, const int factor);
+
+    int factor() const { return m_factor; }
+
+    template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+    void upsample(SrcImageIterator srcUpperLeft,
+                  SrcImageIterator srcLowerRight, SrcAccessor sa,
+                  DestImageIterator destUpperLeft,
+                  DestImageIterator destLowerRight, DestAccessor da);
+    template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+    void upsample(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                  triple<DestImageIterator, DestImageIterator, DestAccessor> dest);
+
+    /**
+     * Calculate only a window of the upsampled image: dest is filled with
+     * the samples starting at destOffset of the image of size factor*(src-1)+1.
+     */
+    template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+    void upsample(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                  triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                  const Diff2D& destOffset);
+
+private:
+    template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+    void upsampleWindow(SrcImageIterator srcUpperLeft,
+                  SrcImageIterator srcLowerRight, SrcAccessor sa,
+                  DestImageIterator destUpperLeft,
+                  DestImageIterator destLowerRight, DestAccessor da,
+                  const Diff2D& destOffset);
+
+    // interpolation of m_src (w x h) to the window of size size at offset,
+    // FACTOR and TAPS are m_factor and m_taps (or 0 to use the runtime values)
+    template <int FACTOR, int TAPS, class DestImageIterator, class DestAccessor>
+    void interpolate(const int w, const int h, const Diff2D& offset, const Diff2D& size,
+                  DestImageIterator destUpperLeft, DestAccessor da);
+    template <int FACTOR, int TAPS, class DestImageIterator, class DestAccessor>
+    STORM_TARGET_AVX2 void interpolateAVX2(const int w, const int h, const Diff2D& offset, 
+                  const Diff2D& size, DestImageIterator destUpperLeft, DestAccessor da) {
+        interpolate<FACTOR, TAPS>(w, h, offset, size, destUpperLeft, da);
+    }
+    template <int FACTOR, int TAPS, class DestImageIterator, class DestAccessor>
+    STORM_TARGET_AVX512 void interpolateAVX512(const int w, const int h, const Diff2D& offset, 
+                  const Diff2D& size, DestImageIterator destUpperLeft, DestAccessor da) {
+        interpolate<FACTOR, TAPS>(w, h, offset, size, destUpperLeft, da);
+    }
+    // the variant of interpolate() for cpuPath()
+    template <int FACTOR, int TAPS, class DestImageIterator, class DestAccessor>
+    void interpolatePath(const int w, const int h, const Diff2D& offset, const Diff2D& size,
+                  DestImageIterator destUpperLeft, DestAccessor da) {
+        switch(kernelPath(CPU_AVX512)) {
+            case CPU_AVX512:
+                interpolateAVX512<FACTOR, TAPS>(w, h, offset, size, destUpperLeft, da);
+                break;
+            case CPU_AVX2:
+                interpolateAVX2<FACTOR, TAPS>(w, h, offset, size, destUpperLeft, da);
+                break;
+            default:
+                interpolate<FACTOR, TAPS>(w, h, offset, size, destUpperLeft, da);
+        }
+    }
+
+    static int mirror(const int m, const int len) {
+        return (m < 0) ? -m : (m >= len) ? 2*len-2-m : m;
+    }
+
+    int m_factor;
+    int m_taps;                 // number of taps of all phases (zero-padded)
+    int m_first;                // offset of the first tap (source index i/factor + m_first)
+    std::vector<double> m_weights; // m_weights[phase*m_taps+t], in order of summation
+    std::vector<T> m_src, m_tmp;
+    std::vector<double> m_sum;  // line of the vertical pass for factor 2
+};
+
+template <class T>
+template <class SPLINE>
+void SplineUpsampling<T>::init(const SPLINE& spline, const int factor) {
+    vigra_precondition(spline.prefilterCoefficients().size() == 0,
+        "SplineUpsampling::init(): prefiltering is not supported.");
+    vigra_precondition(factor > 0, "SplineUpsampling::init(): factor must be positive.");
+    m_factor = factor;
+    ArrayVector<Kernel1D<double> > kernels(factor);
+    resampling_detail::MapTargetToSourceCoordinate mapCoordinate(Rational<int>(factor), Rational<int>(0));
+    createResamplingKernels(spline, mapCoordinate, kernels);
+
+    // resamplingConvolveLine() sums from is-right to is-left
+    m_first = 0;
+    int last = 0;
+    for(int p = 0; p < factor; ++p) {
+        m_first = std::min(m_first, -kernels[p].right());
+        last = std::max(last, -kernels[p].left());
+    }
+    m_taps = last-m_first+1;
+    m_weights.assign(factor*m_taps, 0.); // leading and trailing zeros add nothing
+    for(int p = 0; p < factor; ++p) {
+        for(int m = -kernels[p].right(); m <= -kernels[p].left(); ++m) {
+            m_weights[p*m_taps+m-m_first] = kernels[p][-m];
+        }
+    }
+}
+
+template <class T>
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+void SplineUpsampling<T>::upsample(SrcImageIterator srcUpperLeft,
+                  SrcImageIterator srcLowerRight, SrcAccessor sa,
+                  DestImageIterator destUpperLeft,
+                  DestImageIterator destLowerRight, DestAccessor da) {
+    const int w = srcLowerRight.x - srcUpperLeft.x;
+    const int h = srcLowerRight.y - srcUpperLeft.y;
+    const int w_xxl = destLowerRight.x - destUpperLeft.x;
+    const int h_xxl = destLowerRight.y - destUpperLeft.y;
+    vigra_precondition(w_xxl == m_factor*(w-1)+1 && h_xxl == m_factor*(h-1)+1,
+        "SplineUpsampling::upsample(): destination must have size factor*(src-1)+1.");
+    upsampleWindow(srcUpperLeft, srcLowerRight, sa, destUpperLeft, destLowerRight, da, Diff2D(0,0));
+}
+
+template <class T>
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+void SplineUpsampling<T>::upsampleWindow(SrcImageIterator srcUpperLeft,
+                  SrcImageIterator srcLowerRight, SrcAccessor sa,
+                  DestImageIterator destUpperLeft,
+                  DestImageIterator destLowerRight, DestAccessor da,
+                  const Diff2D& destOffset) {
+    const int w = srcLowerRight.x - srcUpperLeft.x;
+    const int h = srcLowerRight.y - srcUpperLeft.y;
+    const Diff2D size = destLowerRight - destUpperLeft;
+    vigra_precondition(w > 1 && h > 1,
+        "SplineUpsampling::upsample(): source must be at least 2x2.");
+    vigra_precondition(destOffset.x >= 0 && destOffset.y >= 0 &&
+        destOffset.x+size.x <= m_factor*(w-1)+1 && destOffset.y+size.y <= m_factor*(h-1)+1,
+        "SplineUpsampling::upsample(): destination window outside of the upsampled image.");
+
+    // copy the source to contiguous memory
+    m_src.resize(w*h);
+    SrcImageIterator sy = srcUpperLeft;
+    for(int y = 0; y < h; ++y, ++sy.y) {
+        typename SrcImageIterator::row_iterator s = sy.rowIterator();
+        for(int x = 0; x < w; ++x, ++s) {
+            m_src[y*w+x] = sa(s);
+        }
+    }
+
+    // dispatch to the specialized kernels
+    if(m_factor == 2) { // summed in double, as in vigra
+        interpolatePath<2,0>(w, h, destOffset, size, destUpperLeft, da);
+        return;
+    }
+    if(m_taps == 5) { // cubic spline
+        switch(m_factor) {
+            case 4:
+                interpolatePath<4,5>(w, h, destOffset, size, destUpperLeft, da);
+                return;
+            case 8:
+                interpolatePath<8,5>(w, h, destOffset, size, destUpperLeft, da);
+                return;
+            case 16:
+                interpolatePath<16,5>(w, h, destOffset, size, destUpperLeft, da);
+                return;
+        }
+    }
+    interpolatePath<0,0>(w, h, destOffset, size, destUpperLeft, da);
+}
+
+template <class T>
+template <int FACTOR, int TAPS, class DestImageIterator, class DestAccessor>
+STORM_ALWAYS_INLINE void SplineUpsampling<T>::interpolate(const int w, const int h, const Diff2D& offset, const Diff2D& size,
+                  DestImageIterator destUpperLeft, DestAccessor da) {
+    const int factor = FACTOR ? FACTOR : m_factor;
+    const int taps = TAPS ? TAPS : m_taps;
+    typedef typename UpsamplingSum<FACTOR, T>::type Sum;
+
+    // interpolate along y: tmp is w x size.y
+    m_tmp.resize(w*size.y);
+    for(int j = offset.y; j < offset.y+size.y; ++j) {
+        const int first = j/factor + m_first;
+        const double * weights = &m_weights[(j%factor)*taps];
+        T * t = &m_tmp[(j-offset.y)*w];
+        if(FACTOR == 2) { // same sums as resamplingExpandLine2()
+            m_sum.resize(w);
+            double * sum = &m_sum[0];
+            for(int x = 0; x < w; ++x) {
+                sum[x] = 0.;
+            }
+            for(int k = 0; k < taps; ++k) {
+                const double wk = weights[k];
+                const T * s = &m_src[mirror(first+k, h)*w];
+                for(int x = 0; x < w; ++x) {
+                    sum[x] += wk * s[x];
+                }
+            }
+            for(int x = 0; x < w; ++x) {
+                t[x] = T(sum[x]);
+            }
+            continue;
+        }
+        for(int x = 0; x < w; ++x) {
+            t[x] = T();
+        }
+        for(int k = 0; k < taps; ++k) {
+            const double wk = weights[k];
+            const T * s = &m_src[mirror(first+k, h)*w];
+            for(int x = 0; x < w; ++x) { // same rounding as resamplingConvolveLine()
+                t[x] = T(t[x] + wk * s[x]);
+            }
+        }
+    }
+
+    // interpolate along x, all phases of one source pixel at a time
+    const int end = offset.x+size.x;
+    DestImageIterator dy = destUpperLeft;
+    for(int j = 0; j < size.y; ++j, ++dy.y) {
+        const T * t = &m_tmp[j*w];
+        typename DestImageIterator::row_iterator d = dy.rowIterator();
+        for(int q = offset.x/factor; q*factor < end; ++q) {
+            const int first = q + m_first;
+            const int p_beg = std::max(offset.x-q*factor, 0);
+            const int p_end = std::min(end-q*factor, factor);
+            if(first >= 0 && first+taps <= w) {
+                for(int p = p_beg; p < p_end; ++p, ++d) {
+                    const double * weights = &m_weights[p*taps];
+                    Sum sum = Sum();
+                    for(int k = 0; k < taps; ++k) {
+                        sum = Sum(sum + weights[k] * t[first+k]);
+                    }
+                    da.set(sum, d);
+                }
+            } else { // reflect at the border
+                for(int p = p_beg; p < p_end; ++p, ++d) {
+                    const double * weights = &m_weights[p*taps];
+                    Sum sum = Sum();
+                    for(int k = 0; k < taps; ++k) {
+                        sum = Sum(sum + weights[k] * t[mirror(first+k, w)]);
+                    }
+                    da.set(sum, d);
+                }
+            }
+        }
+    }
+}
+
+template <class T>
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+inline
+void SplineUpsampling<T>::upsample(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                  triple<DestImageIterator, DestImageIterator, DestAccessor> dest) {
+    upsample(src.first, src.second, src.third,
+             dest.first, dest.second, dest.third);
+}
+
+template <class T>
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+inline
+void SplineUpsampling<T>::upsample(triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                  triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                  const Diff2D& destOffset) {
+    upsampleWindow(src.first, src.second, src.third,
+             dest.first, dest.second, dest.third, destOffset);
+}
+
+#endif // SPLINEUPSAMPLING_H
@@ -8,12 +8,11 @@
 /*    joachim.schleicher@iwr.uni-heidelberg.de                          */
 /************************************************************************/
 
-#define CHUNKSIZE 10
-
 #include <iostream>
 #include <iomanip>
 #include <fstream>
 #include <map>
+#include <cstdio>
 #include "program_options_getopt.h"
 #include "wienerStorm.hxx"
 #include "configVersion.hxx"
@@ -44,13 +43,24 @@ int main(int argc, char** argv) {
     std::string filterfile = files['f'];
     std::string frames = files['F'];
     char verbose = (char)params['v'];
-        
-    if(verbose) {
-        std::cout << "thr:" << threshold << " factor:" << factor << std::endl;
-    }
+    int checkpointInterval = (int)params['C'];
+    bool resume = params['R'] > 0;
+    bool shard = params['S'] > 0;
+    bool makeFilter = params['W'] > 0;
     
     try
     {
+        StormOptions options;
+        options.method = localizationMethodFromString(files['M']);
+        options.background = backgroundMethodFromString(files['B']);
+        options.tileSize = (int)params['T'];
+        vigra_precondition(options.tileSize >= 0, "tile-size must not be negative.");
+
+        if(verbose) {
+            std::cout << "thr:" << threshold << " factor:" << factor 
+                << " method:" << localizationMethodName(options.method) 
+                << " background:" << backgroundMethodName(options.background) << std::endl;
+        }
 
         MultiArray<3,float> in;
         typedef MultiArrayShape<3>::type Shape;
@@ -68,15 +78,25 @@ int main(int argc, char** argv) {
         }
 
 
-        // found spots. One Vector over all images in stack
-        // the inner set contains all spots in the image
-        std::vector<std::set<Coord<float> > > res_coords(stacksize);
         BasicImage<float> filter(info.shapeOfDimension(0), info.shapeOfDimension(1)); // filter in fourier space
         DImage res((size2-Diff2D(1,1))*factor+Diff2D(1,1));
         // check if outfile is writable, otherwise throw error -> exit
-        exportImage(srcImageRange(res), ImageExportInfo(outfile.c_str()));
-        if(coordsfile!="") {
-            std::ofstream cf (coordsfile.c_str());
+        // (a shard saves the accumulator instead, see storm-merge)
+        if(!shard && !makeFilter) {
+            exportImage(srcImageRange(res), ImageExportInfo(outfile.c_str()));
+        }
+        const std::string accfile = accumulatorFilename(coordsfile);
+        if(shard) {
+            // all shards filter with the same filter
+            vigra_precondition(helper::fileExists(filterfile), 
+                    "In shard mode the filter file must exist, create it first with --make-filter.");
+            // the accumulator is written when the shard is complete, storm-merge 
+            // must not take the one of an earlier run for this one
+            std::remove(accfile.c_str());
+        }
+        if(coordsfile!="" && !makeFilter) {
+            // (appending keeps the file of an aborted run for --resume)
+            std::ofstream cf (coordsfile.c_str(), std::ios::app);
             vigra_precondition(cf.is_open(), "Could not open coordinate-file for writing.");
             cf.close();
         }
@@ -86,28 +106,72 @@ int main(int argc, char** argv) {
 
         // STORM Algorithmus
         generateFilter(info, filter, filterfile);  // use the specified one or create wiener filter from the data
-        wienerStorm(info, filter, res_coords, threshold, factor, roilen, frames, verbose);
-        
-        // resulting image
-        drawCoordsToImage<Coord<float> >(res_coords, res);
-        
-        int numSpots = 0;
-        if(coordsfile != "") {
-            numSpots = saveCoordsFile(coordsfile, res_coords, info.shape(), factor);
+        options.psfWidth = estimatePSFWidth(filter);
+        if(verbose) {
+            std::cout << "estimated spot width: " << options.psfWidth << " px" << std::endl;
+        }
+        if(makeFilter) {
+            std::cout << "filter for the shards: " << filterfile << std::endl;
+            return 0;
+        }
+
+        // everything the output depends on, a checkpoint is only resumed 
+        // by a run with the same fingerprint
+        Fingerprint fingerprint;
+        fingerprint.add(infile);
+        for(int d = 0; d < 3; ++d) {
+            fingerprint.add((int)info.shape(d));
+        }
+        fingerprint.add(threshold);
+        fingerprint.add(factor);
+        fingerprint.add(roilen);
+        fingerprint.add(frames);
+        fingerprint.add((int)options.method);
+        fingerprint.add((int)options.background);
+        fingerprint.add(options.tileSize);
+        fingerprint.add(coordsfile);
+        fingerprint.addImage(filter);
+        if(verbose) {
+            std::cout << "fingerprint of the run: " << std::hex << fingerprint.value() << std::dec << std::endl;
+        }
+
+        const std::string checkpointfile = (coordsfile != "" ? coordsfile : outfile) + ".checkpoint";
+        Checkpoint checkpoint;
+        if(resume && !helper::fileExists(checkpointfile)) {
+            std::cout << "no checkpoint found, starting with the first frame" << std::endl;
+            resume = false;
+        }
+        if(resume) {
+            vigra_precondition(loadCheckpoint(checkpointfile, checkpoint, res), 
+                    "Could not read the checkpoint file.");
+            vigra_precondition(checkpoint.fingerprint == fingerprint.value(), 
+                    "The checkpoint was written by a run with other parameters or another filter.");
+            options.resumeFrame = checkpoint.done;
+            std::cout << "resuming with frame " << checkpoint.done << std::endl;
+        }
+
+        // found spots are written to the coordsfile and drawn into the 
+        // resulting image frame by frame, in the order of the stack
+        StreamingCoordsWriter<Coord<float>, DImage> writer(coordsfile, info.shape(), factor,
+                options.method == MLE_FIT, res, resume ? &checkpoint : 0);
+        if(checkpointInterval > 0) {
+            writer.setCheckpoints(checkpointfile, fingerprint.value(), checkpointInterval);
         }
+        wienerStorm(info, filter, writer, threshold, factor, roilen, frames, verbose, options);
+        int numSpots = writer.numSpots();
+        std::remove(checkpointfile.c_str()); // the run is complete
         
         // end: done.
         TOC;
         std::cout << "detected " << numSpots << " spots." << std::endl;
 
-        // some maxima are very strong so we scale the image as appropriate :
-        double maxlim = 0., minlim = 0;
-        findMinMaxPercentile(res, 0., minlim, 0.996, maxlim);
-        std::cout << "cropping output values to range [" << minlim << ", " << maxlim << "]" << std::endl;
-        if(maxlim > minlim) {
-            transformImage(srcImageRange(res), destImage(res), ifThenElse(Arg1()>Param(maxlim), Param(maxlim), Arg1())); 
+        if(shard) {
+            vigra_postcondition(saveAccumulator(accfile, res, numSpots, factor), 
+                    "Could not write the accumulator file.");
+            std::cout << "shard saved to " << coordsfile << " and " << accfile << std::endl;
+        } else {
+            exportResultImage(res, outfile);
         }
-        exportImage(srcImageRange(res), ImageExportInfo(outfile.c_str()));
         
         
 
@@ -0,0 +1,143 @@
+/************************************************************************/
+/*                                                                      */
+/*                  ANALYSIS OF STORM DATA                              */
+/*                                                                      */
+/*         Copyright 2011 by Joachim Schleicher                         */
+/*                                                                      */
+/*    Please direct questions, bug reports, and contributions to        */
+/*    joachim.schleicher@iwr.uni-heidelberg.de                          */
+/*                                                                      */
+/*    Permission is hereby granted, free of charge, to any person       */
+/*    obtaining a copy of this software and associated documentation    */
+/*    files (the "Software"), to deal in the Software without           */
+/*    restriction, including without limitation the rights to use,      */
+/*    copy, modify, merge, publish, distribute, sublicense, and/or      */
+/*    sell copies of the Software, and to permit persons to whom the    */
+/*    Software is furnished to do so, subject to the following          */
+/*    conditions:                                                       */
+/*                                                                      */
+/*    The above copyright notice and this permission notice shall be    */
+/*    included in all copies or substantial portions of the             */
+/*    Software.                                                         */
+/*                                                                      */
+/*    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND    */
+/*    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES   */
+/*    OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND          */
+/*    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT       */
+/*    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,      */
+/*    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING      */
+/*    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR     */
+/*    OTHER DEALINGS IN THE SOFTWARE.                                   */
+/************************************************************************/
+
+
+#ifndef TEMPORALBACKGROUND_H
+#define TEMPORALBACKGROUND_H
+
+#include <algorithm>
+#include <cmath>
+#include <vigra/error.hxx>
+#include <vigra/basicimage.hxx>
+
+/*
+ * Per-pixel background model over a sliding window of frames
+ *
+ * The spatial background (BackgroundFilter) is estimated from every
+ * frame alone, so it is lifted by dense spots and has to be computed
+ * again for every frame. Slowly varying autofluorescence is better
+ * separated over time: Single molecules blink, so the background of a
+ * pixel is a low quantile of its values in the neighbouring frames.
+ *
+ * Instead of sorting a window of values per pixel, the tau-quantile is
+ * tracked incrementally: Every frame moves the estimate up by tau*step
+ * if the pixel is brighter and down by (1-tau)*step if it is darker, 
+ * which is in equilibrium if a fraction tau of the values is below the
+ * estimate. Since only the sign of the difference is used, bright spots
+ * do not lift the estimate. The step is proportional to the mean
+ * absolute deviation of the recent values, which is tracked as well.
+ * Both are exponential averages over about window frames, so an update
+ * is O(1) per pixel and the model needs two values per pixel.
+ *
+ * The model is updated by one thread in frame order; the workers only
+ * read snapshots of it (see wienerStorm()). To get results independent
+ * of the number of threads, snapshots are taken every updateInterval()
+ * frames.
+ */
+
+using namespace vigra; // for now
+
+template <class T>
+class TemporalBackground {
+public:
+    typedef T value_type;
+
+    /**
+     * @param window number of frames the model averages over (time constant)
+     * @param tau quantile of the values in the window that is estimated
+     */
+    TemporalBackground(const int w, const int h, const int window=100, const double tau=0.1);
+
+    /**
+     * Add the next frame to the model.
+     */
+    template <class Image>
+    void update(const Image& frame);
+
+    /**
+     * Current estimate of the background (of the raw data)
+     */
+    const BasicImage<T>& estimate() const { return m_bg; }
+
+    int frames() const { return m_frames; }
+    int updateInterval() const { return std::max(1, m_window/4); }
+
+private:
+    BasicImage<T> m_bg;
+    BasicImage<T> m_spread; // mean absolute deviation from m_bg
+    int m_window;
+    double m_tau;
+    int m_frames;
+};
+
+template <class T>
+TemporalBackground<T>::TemporalBackground(const int w, const int h, const int window, const double tau)
+    : m_bg(w, h), m_spread(w, h), m_window(window), m_tau(tau), m_frames(0) {
+    vigra_precondition(window >= 2, "TemporalBackground: window must be at least 2 frames.");
+    vigra_precondition(tau > 0. && tau < 1., "TemporalBackground: tau must be in (0, 1).");
+    m_spread = T();
+}
+
+template <class T>
+template <class Image>
+void TemporalBackground<T>::update(const Image& frame) {
+    const int w = m_bg.width();
+    const int h = m_bg.height();
+    vigra_precondition(frame.width() == w && frame.height() == h,
+        "TemporalBackground::update(): frame has the wrong size.");
+    if(m_frames == 0) {
+        for(int y = 0; y < h; ++y) {
+            T * b = &m_bg(0, y);
+            for(int x = 0; x < w; ++x) {
+                b[x] = frame(x, y);
+            }
+        }
+        ++m_frames;
+        return;
+    }
+    // average over all frames until the window is filled
+    const T alpha = 1. / std::min(m_frames+1, m_window);
+    const T up = 2.*alpha*m_tau;
+    const T down = -2.*alpha*(1.-m_tau);
+    for(int y = 0; y < h; ++y) {
+        T * b = &m_bg(0, y);
+        T * s = &m_spread(0, y);
+        for(int x = 0; x < w; ++x) {
+            T d = frame(x, y) - b[x];
+            s[x] += alpha * (std::abs(d) - s[x]);
+            b[x] += ((d > 0) ? up : down) * s[x];
+        }
+    }
+    ++m_frames;
+}
+
+#endif // TEMPORALBACKGROUND_H
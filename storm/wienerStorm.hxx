@@ -39,9 +39,9 @@
 #include <vigra/multi_array.hxx>
 #include <vigra/inspectimage.hxx>
 #include <vigra/fftw3.hxx> 
-#include <vigra/localminmax.hxx>
 #include <vigra/splineimageview.hxx>
-#include <set>
+#include <vector>
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #ifdef OPENMP_FOUND
@@ -49,7 +49,18 @@
 #endif //OPENMP_FOUND
 
 #include "util.h"
+#include "backgroundfilter.hxx"
 #include "fftfilter.hxx"
+#include "fourierinterpolation.hxx"
+#include "frametiling.hxx"
+#include "framescheduler.hxx"
+#include "frameworkspace.hxx"
+#include "localmaxima.hxx"
+#include "numatopology.hxx"
+#include "peakrefinement.hxx"
+#include "resultwriter.hxx"
+#include "temporalbackground.hxx"
+#include "splinehessian.hxx"
 #include "myimportinfo.h"
 
 using namespace vigra;
@@ -78,39 +89,25 @@ using namespace vigra::functor;
 // helper classes and functions
 //--------------------------------------------------------------------------
 
-/**
- * BSpline coefficients but no prefiltering
- */
-template <int ORDER, class T>
-class BSplineWOPrefilter
- : public BSpline<ORDER, T> {
-
-    public:
-    /** Prefilter coefficients
-        (array has zero length, since image is already prefiltered).
-    */
-    ArrayVector<double> const & prefilterCoefficients() const
-    {
-        static ArrayVector<double> b;
-        return b;
-    }
-};
-
 /**
  * Class to keep an image coordinate with corresponding pixel value
  * 
  * This corresponds to a vigra::Point2D with an additional value at that coordinate.
+ * The position is given in pixels of the upsampled image (i.e. multiplied
+ * by factor). It is integral for the upsampling methods and continuous
+ * for the refinement methods.
  */
 template <class VALUETYPE>
 class Coord{
     public:
         typedef VALUETYPE value_type;
-        Coord(const int x_,const int y_,const VALUETYPE val_,const VALUETYPE asym_=1.) 
-            : x(x_), y(y_), val(val_), asymmetry(asym_) {  }
-        int x;
-        int y;
+        Coord(const float x_,const float y_,const VALUETYPE val_,const VALUETYPE asym_=1.) 
+            : x(x_), y(y_), val(val_), asymmetry(asym_), uncertainty(0.) {  }
+        float x;
+        float y;
         VALUETYPE val;
         VALUETYPE asymmetry;
+        VALUETYPE uncertainty; // standard deviation of the position (in pixels), if known
 
         bool operator<(const Coord<VALUETYPE>& c2) const {
             return ((this->y==c2.y)&&(this->x < c2.x)) || (this->y < c2.y);
@@ -123,84 +120,91 @@ class Coord{
         }
 };
 
+template <class C>
+bool samePosition(const C& c1, const C& c2) {
+    return (c1.x == c2.x) && (c1.y == c2.y);
+}
 
-// hack to push the coordinates into an array instead of marking them in 
-// a target image.
-// This is used as an accessor although it doesn't access the pixel values ;-)
-// To work on ROIs, a global offset can be set with setOffset().
-template <class T, class ITERATOR>
-class VectorPushAccessor{
-    public:
-        typedef typename T::value_type value_type;
-        VectorPushAccessor(std::set<T>& arr, ITERATOR it_start)
-            : m_arr(arr), m_it_start(it_start), m_offset() {        }
-
-        T const &   operator() (ITERATOR const &i) const {
-            return NumericTraits<T>::zero();
+/**
+ * Sort the coordinates of a frame by position (row-major) and remove 
+ * duplicates from overlapping ROIs. 
+ * Of several coordinates at the same position, the first one is kept.
+ *
+ * The sort is stable as std::stable_sort(), which allocates a buffer 
+ * for every call. Here, sorted runs are merged through the scratch 
+ * buffer tmp instead (it keeps its capacity from frame to frame).
+ */
+template <class C>
+void squeezeDuplicates(std::vector<C>& coords, std::vector<C>& tmp) {
+    const int n = coords.size();
+    if(n > 1) {
+        // runs sorted by insertion, then merged pairwise
+        const int run = 16;
+        for(int b = 0; b < n; b += run) {
+            const int e = std::min(b+run, n);
+            for(int i = b+1; i < e; ++i) {
+                const C c = coords[i];
+                int j = i;
+                for(; j > b && c < coords[j-1]; --j) {
+                    coords[j] = coords[j-1];
+                }
+                coords[j] = c;
+            }
         }
-        template<class V>
-        void    set (V const & /*value*/, ITERATOR const &i) {
-            int x = i.x+m_offset.x;
-            int y = i.y-m_it_start.y+m_offset.y;
-            typename T::value_type val = *i;
-            T c (x,y,val);
-            m_arr.insert(c);
+        tmp.resize(n, coords[0]);
+        C * src = &coords[0];
+        C * dest = &tmp[0];
+        for(int width = run; width < n; width *= 2) {
+            for(int lo = 0; lo < n; lo += 2*width) {
+                const int mid = std::min(lo+width, n);
+                const int hi = std::min(lo+2*width, n);
+                std::merge(src+lo, src+mid, src+mid, src+hi, dest+lo);
+            }
+            std::swap(src, dest);
         }
-        void setOffset(Diff2D offset) {
-            m_offset = offset;
+        if(src != &coords[0]) {
+            std::copy(src, src+n, coords.begin());
         }
+    }
+    coords.erase(std::unique(coords.begin(), coords.end(), samePosition<C>), coords.end());
+}
 
-    private:
-        std::set<T>& m_arr;
-        ITERATOR m_it_start;
-        Diff2D m_offset;
-};
 
 /**
- * Draw coordinates from all frames into the result image
+ * Append the pixels at the offsets (y*stride+x relative to p) to a 
+ * list of coordinates, offset is added to the coordinates.
  */
-template <class C, class Image>
-void drawCoordsToImage(const std::vector<std::set<C> >& coords, Image& res) {
-    res = 0;
-    typename std::vector<std::set<C> >::const_iterator it;
-    //  loop over the images
-    for(it = coords.begin(); it != coords.end(); ++it) {
-        drawCoordsToImage( *it, res);
+template <class T>
+void pushIndices(const T * p, const int stride, const int * indices, const int n,
+            const Diff2D& offset, std::vector<Coord<T> >& coords) {
+    for(int i = 0; i < n; ++i) {
+        int y = indices[i] / stride;
+        int x = indices[i] - y*stride;
+        coords.push_back(Coord<T>(x+offset.x, y+offset.y, p[indices[i]]));
     }
 }
 
 /**
- *  Draw coordinates detected in one frame into the resulting image
+ * Append the local maxima of an image region to a list of coordinates.
+ * 
+ * The region [ul, lr) is searched with localMaximaIndices(), 
+ * offset is added to the coordinates relative to ul.
+ * indices is a scratch buffer of at least (width-2)*(height-2) entries.
  */
-template <class C, class Image>
-void drawCoordsToImage(const std::set<C>& coords, Image& res) {
-    //  loop over the coordinates
-    typename std::set<C>::iterator it2;
-
-    for(it2 = coords.begin(); it2 != coords.end(); it2++) {
-        const C& c = *it2;
-        res(c.x, c.y) += c.val;
-    }
-}
-
-template <class C>
-int saveCoordsFile(const std::string& filename, const std::vector<std::set<C> >& coords, 
-            const MultiArrayShape<3>::type & shape, const int factor) {
-    int numSpots = 0;
-    std::set<Coord<float> >::iterator it2;
-    std::ofstream cfile (filename.c_str());
-    cfile << shape[0] << " " << shape[1] << " " << shape[2] << std::endl;
-    cfile << std::fixed; // fixed instead of scientific format
-    for(unsigned int j = 0; j < coords.size(); j++) {
-        for(it2=coords[j].begin(); it2 != coords[j].end(); it2++) {
-            numSpots++;
-            const Coord<float>& c = *it2;
-            cfile << std::setprecision(3) << (float)c.x/factor << " " << (float)c.y/factor << " "
-                << j << " " << std::setprecision(1) << c.val << " " << std::setprecision(3) << c.asymmetry << std::endl;
-        }
+template <class T>
+void pushLocalMaxima(const BasicImageView<T>& im, const Diff2D& ul, const Diff2D& lr, 
+            const T threshold, const Diff2D& offset,
+            std::vector<int>& indices, std::vector<Coord<T> >& coords) {
+    const int w = lr.x-ul.x;
+    const int h = lr.y-ul.y;
+    if(w < 3 || h < 3) { // no internal pixels
+        return;
     }
-    cfile.close();
-    return numSpots;
+    vigra_precondition(indices.size() >= (unsigned int)((w-2)*(h-2)),
+        "pushLocalMaxima(): index buffer too small.");
+    const T * p = &im(ul.x, ul.y);
+    int n = localMaximaIndices(p, im.width(), w, h, threshold, &indices[0]);
+    pushIndices(p, im.width(), &indices[0], n, offset, coords);
 }
 
 /** 
@@ -219,37 +223,65 @@ void findMinMaxPercentile(Image& im, double minPerc, double& minVal, double maxP
     maxVal=v[(int)(v.size()*maxPerc)];
 }
 
+/**
+ * Clip the strongest maxima of the result image (above the 99.6% percentile)
+ * and save it to outfile
+ */
+template <class Image>
+void exportResultImage(Image& res, const std::string& outfile) {
+    // some maxima are very strong so we scale the image as appropriate :
+    double maxlim = 0., minlim = 0;
+    findMinMaxPercentile(res, 0., minlim, 0.996, maxlim);
+    std::cout << "cropping output values to range [" << minlim << ", " << maxlim << "]" << std::endl;
+    if(maxlim > minlim) {
+        transformImage(srcImageRange(res), destImage(res), ifThenElse(Arg1()>Param(maxlim), Param(maxlim), Arg1())); 
+    }
+    exportImage(srcImageRange(res), ImageExportInfo(outfile.c_str()));
+}
+
+/**
+ * Ratio of the eigenvalues of the Hessian matrix.
+ * This is 1 for a symmetric spot and decreases for elongated spots.
+ */
+template <class T>
+inline T hessianAsymmetry(const T sxx, const T syy, const T sxy) {
+    // calculate the eigenvalues
+    T ev1 = (sxx+syy)/2. - sqrt((sxx+syy)*(sxx+syy)/4. + sxy*sxy - sxx*syy);
+    T ev2 = (sxx+syy)/2. + sqrt((sxx+syy)*(sxx+syy)/4. + sxy*sxy - sxx*syy);
+    return ev1/ev2;
+}
+
 /**
  * Add asymmetry to the coordinates list
  */
 template <class SrcIterator, class SrcAccessor, class T>
 inline void determineAsymmetry(triple<SrcIterator, SrcIterator, SrcAccessor> s,
-        std::set<Coord<T> >& coords,
-        const int factor) {
-    determineAsymmetry(s.first, s.second, s.third, coords, factor);
+        std::vector<Coord<T> >& coords,
+        const int factor, SplineHessian<T>& hessian) {
+    determineAsymmetry(s.first, s.second, s.third, coords, factor, hessian);
 }
 
+/**
+ * The Hessian of the (not prefiltered) cubic spline is only evaluated
+ * in the 4x4 neighbourhood of each spot, such that the cost does not
+ * depend on the frame size. hessian is scratch memory.
+ */
 template <class SrcIterator, class SrcAccessor, class T>
 void determineAsymmetry(SrcIterator srcUpperLeft,
         SrcIterator srcLowerRight,
         SrcAccessor acc,
-        std::set<Coord<T> >& coords,
-        const int factor) {
-    vigra::SplineImageView<3,T> sview(srcUpperLeft, srcLowerRight, acc, true);
-    std::set<Coord<float> > newcoords;
-    std::set<Coord<float> >::iterator it2;
+        std::vector<Coord<T> >& coords,
+        const int factor, SplineHessian<T>& hessian) {
+    hessian.clear();
+    typename std::vector<Coord<T> >::const_iterator it2;
     for(it2 = coords.begin(); it2 != coords.end(); it2++) {
-        const Coord<float>& c = *it2;
-        T sxx = sview.dxx((float)(c.x)/factor, (float)(c.y)/factor);
-        T syy = sview.dyy((float)(c.x)/factor, (float)(c.y)/factor);
-        T sxy = sview.dxy((float)(c.x)/factor, (float)(c.y)/factor);
-        // calculate the eigenvalues
-        T ev1 = (sxx+syy)/2. - sqrt((sxx+syy)*(sxx+syy)/4. + sxy*sxy - sxx*syy);
-        T ev2 = (sxx+syy)/2. + sqrt((sxx+syy)*(sxx+syy)/4. + sxy*sxy - sxx*syy);
-        Coord<float> cc (c.x, c.y, c.val, ev1/ev2);
-        newcoords.insert(cc); // copy for now. Hack hack hack...
+        hessian.addPoint(srcUpperLeft, srcLowerRight, acc,
+                (float)(it2->x)/factor, (float)(it2->y)/factor);
+    }
+    hessian.compute();
+    for(int i = 0; i < hessian.size(); ++i) {
+        coords[i].asymmetry = hessianAsymmetry(hessian.dxx(i), hessian.dyy(i), hessian.dxy(i));
     }
-    coords=newcoords;
 }
 
 
@@ -431,7 +463,12 @@ void generateFilter(StormDataSet& in, BasicImage<T>& filter, const std::string&
             std::cout << "using filter from file " << filterfile << std::endl;
             vigra::BasicImage<T> filterIn(filterinfo.width(), filterinfo.height());
             vigra::importImage(filterinfo, destImage(filterIn)); // read the image
-            vigra::resizeImageSplineInterpolation(srcImageRange(filterIn), destImageRange(filter));
+            if(filterIn.size() == filter.size()) {
+                // exactly the filter that was saved (e.g. by the run that is resumed)
+                filter = filterIn;
+            } else {
+                vigra::resizeImageSplineInterpolation(srcImageRange(filterIn), destImageRange(filter));
+            }
             constructNewFilter = false;
         }
         else
@@ -451,16 +488,195 @@ void generateFilter(StormDataSet& in, BasicImage<T>& filter, const std::string&
 // STORM DATA PROCESSING
 //--------------------------------------------------------------------------
 
+/**
+ * Method to find the sub-pixel position around each maximum candidate
+ */
+enum LocalizationMethod { 
+    SPLINE_UPSAMPLING,  // cubic B-spline approximation (default)
+    FOURIER_UPSAMPLING, // band-limited interpolation by a small DFT per ROI
+    NEWTON_REFINEMENT,  // Newton iterations on the B-spline, no upsampling
+    MLE_FIT,            // Gaussian maximum likelihood fit to the raw data
+    PEAK_UPSAMPLING,    // cubic B-spline, only the neighbourhood of the candidate pixel
+    QUICKLOOK_DETECTION // parabola through the 3x3 neighbourhood, for previews
+};
+
+/**
+ * Parse the name of a localization method as given on the command line
+ */
+inline LocalizationMethod localizationMethodFromString(const std::string& name) {
+    if(name == "" || name == "spline") {
+        return SPLINE_UPSAMPLING;
+    } else if(name == "fourier") {
+        return FOURIER_UPSAMPLING;
+    } else if(name == "newton") {
+        return NEWTON_REFINEMENT;
+    } else if(name == "mle") {
+        return MLE_FIT;
+    } else if(name == "peak") {
+        return PEAK_UPSAMPLING;
+    } else if(name == "quicklook") {
+        return QUICKLOOK_DETECTION;
+    }
+    vigra_fail(("unknown localization method '" + name + "'. Use spline, fourier, newton, mle, peak or quicklook.").c_str());
+    return SPLINE_UPSAMPLING; // never reached
+}
+
+inline const char * localizationMethodName(const LocalizationMethod method) {
+    switch(method) {
+        case FOURIER_UPSAMPLING:
+            return "fourier";
+        case NEWTON_REFINEMENT:
+            return "newton";
+        case MLE_FIT:
+            return "mle";
+        case PEAK_UPSAMPLING:
+            return "peak";
+        case QUICKLOOK_DETECTION:
+            return "quicklook";
+        case SPLINE_UPSAMPLING:
+        default:
+            return "spline";
+    }
+}
+
+/**
+ * Method to estimate the background of a frame
+ */
+enum BackgroundMethod {
+    SPATIAL_BACKGROUND,  // recursive smoothing of every frame (default)
+    TEMPORAL_BACKGROUND  // rolling per-pixel model over the frames, see TemporalBackground
+};
+
+inline BackgroundMethod backgroundMethodFromString(const std::string& name) {
+    if(name == "" || name == "spatial") {
+        return SPATIAL_BACKGROUND;
+    } else if(name == "temporal") {
+        return TEMPORAL_BACKGROUND;
+    }
+    vigra_fail(("unknown background method '" + name + "'. Use spatial or temporal.").c_str());
+    return SPATIAL_BACKGROUND; // never reached
+}
+
+inline const char * backgroundMethodName(const BackgroundMethod method) {
+    return (method == TEMPORAL_BACKGROUND) ? "temporal" : "spatial";
+}
+
+/**
+ * Settings of the localization that are not given as separate arguments
+ */
+class StormOptions {
+    public:
+        StormOptions() 
+            : method(SPLINE_UPSAMPLING), background(SPATIAL_BACKGROUND), psfWidth(0.), tileSize(0),
+              resumeFrame(0) {  }
+        LocalizationMethod method;
+        BackgroundMethod background;
+        float psfWidth; // width of the spots in pixels, see estimatePSFWidth() (0: unknown)
+        int tileSize;   // process larger frames in tiles of this size, see FrameTiling (0: never)
+        int resumeFrame; // the frames before are done, see Checkpoint (0: none)
+};
+
+/**
+ * Estimate the width (standard deviation in pixels) of the spots 
+ * from the Wiener filter (DC in the upper left corner).
+ *
+ * The filter passes the frequencies where the spots have more power 
+ * than the noise, i.e. its passband shrinks for wider spots. Approximating 
+ * the filter by a Gaussian exp(-2 pi^2 s^2 |f|^2), s is obtained from 
+ * the second moment of the filter: <f_x^2> = 1/(4 pi^2 s^2).
+ * This is a rough estimate, good enough to choose ROI sizes.
+ */
+template <class Image>
+double estimatePSFWidth(const Image& filter) {
+    const int w = filter.width();
+    const int h = filter.height();
+    double sum = 0., sumf2 = 0.;
+    for(int y = 0; y < h; ++y) {
+        double fy = (double)((y <= h/2) ? y : y-h) / h;
+        for(int x = 0; x < w; ++x) {
+            double fx = (double)((x <= w/2) ? x : x-w) / w;
+            double v = std::max(0., (double)filter(x, y));
+            sum += v;
+            sumf2 += (fx*fx + fy*fy) * v;
+        }
+    }
+    if(sumf2 <= 0.) {
+        return 0.;
+    }
+    return 1. / (2.*M_PI*std::sqrt(sumf2/(2.*sum)));
+}
+
+/**
+ * Radius (in pixels) around a candidate that the peak method searches 
+ * at sub-pixel resolution: One pixel, more for wide spots, but not
+ * more than the ROI of the spline method.
+ */
+inline int peakSearchRadius(const float psfWidth, const int mylen) {
+    int radius = (int)(psfWidth/2. + 0.5);
+    return std::max(1, std::min(radius, mylen/2-2));
+}
+
+/**
+ * Halo (in pixels) around the core of a tile, see FrameTiling:
+ * The ROIs of the candidates in the core and, for the spatial 
+ * background, four times the scale of the recursive filter, where 
+ * the influence of the tile border has decayed below 2%.
+ */
+inline int tileHalo(const int mylen, const BackgroundMethod background) {
+    int halo = mylen;
+    if(background == SPATIAL_BACKGROUND) {
+        halo += (int)std::ceil(4.*BackgroundFilter<float>().scale());
+    }
+    return halo;
+}
+
+/**
+ * Largest radius (in pixels) of the filter on a tile, see FrameTiling:
+ * The impulse response of the Wiener filter is about as wide as the 
+ * PSF, at six times its width it has decayed far below the tolerance.
+ * Without an estimate of the width, the tile size.
+ */
+inline int tileFilterRadius(const float psfWidth, const int tileSize) {
+    int radius = tileSize;
+    if(psfWidth > 0) {
+        radius = std::min(radius, (int)std::ceil(6.*psfWidth));
+    }
+    return std::max(1, radius);
+}
+
 /** 
  * Estimate Background level and subtract it from the image
  */
 template <class Image>
 void subtractBackground(Image& im, Image& bg) {
-    float sigma = 10.; // todo: estimate from data
-    vigra::recursiveSmoothX(srcImageRange(im), destImage(bg), sigma);
-    vigra::recursiveSmoothY(srcImageRange(bg), destImage(bg), sigma);
+    BackgroundFilter<typename Image::value_type> filter;
+    filter.subtract(im, bg);
+}
 
-    vigra::combineTwoImages(srcImageRange(im), srcImage(bg), destImage(im), Arg1()-Arg2());
+/**
+ * Subtract a precomputed background (e.g. of a TemporalBackground) 
+ * from the image and copy it to bg.
+ * The image corresponds to the model at offset (e.g. a tile of the frame).
+ *
+ * @return minimum of the background
+ */
+template <class Image, class BgImage>
+typename Image::value_type subtractBackground(Image& im, Image& bg, const BgImage& model,
+            const Diff2D& offset=Diff2D(0,0)) {
+    typedef typename Image::value_type T;
+    vigra_precondition(offset.x >= 0 && offset.y >= 0 &&
+        model.width() >= offset.x+im.width() && model.height() >= offset.y+im.height(),
+        "subtractBackground(): background has the wrong size.");
+    T minimum = model(offset.x, offset.y);
+    for(int y = 0; y < im.height(); ++y) {
+        for(int x = 0; x < im.width(); ++x) {
+            T v = model(offset.x+x, offset.y+y);
+            bg(x, y) = v;
+            im(x, y) -= v;
+            minimum = std::min(minimum, v);
+        }
+    }
+    return minimum;
 }
 
 /**
@@ -477,6 +693,469 @@ void prefilterBSpline(Image& im) {
     }
 }
 
+/**
+ * ROI of size mylen around a maximum candidate, clipped to the frame
+ */
+template <class C>
+inline void candidateROI(const C& c, const int mylen, const Diff2D& size, Diff2D& roi_ul, Diff2D& roi_lr) {
+    const int mylen2 = mylen/2;
+    roi_ul = Diff2D(std::max((int)c.x-mylen2, 0), std::max((int)c.y-mylen2, 0));
+    roi_lr = Diff2D(std::min((int)c.x-mylen2+mylen, size.x), std::min((int)c.y-mylen2+mylen, size.y));
+}
+
+/**
+ * Group the ROIs of the candidates to regions of overlapping ROIs.
+ *
+ * Candidates with a very low signal are skipped. The candidates are
+ * sorted row by row, so a region can not grow anymore as soon as its 
+ * lower border is above the current ROI. A region is at most maxlen 
+ * pixels wide and high; an overlapping ROI that does not fit anymore 
+ * starts a new region. The candidates of a region form a linked list
+ * starting at region.first, nextMember[k] is the candidate after k (or -1).
+ */
+template <class Image, class T>
+void mergeCandidateRegions(const Image& filtered, const Image& bg, const T baseline,
+            const std::vector<Coord<T> >& candidates, const int mylen, const int maxlen,
+            std::vector<CandidateRegion>& regions, std::vector<int>& nextMember) {
+    regions.clear();
+    nextMember.assign(candidates.size(), -1);
+    unsigned int firstOpen = 0;
+    for(unsigned int k = 0; k < candidates.size(); ++k) {
+        const Coord<T>& c = candidates[k];
+        if(filtered(c.x,c.y)<(bg(c.x,c.y)-baseline)) { // skip very low signals
+            continue;
+        }
+        Diff2D roi_ul, roi_lr;
+        candidateROI(c, mylen, filtered.size(), roi_ul, roi_lr);
+        while(firstOpen < regions.size() && regions[firstOpen].lr.y <= roi_ul.y) {
+            ++firstOpen;
+        }
+        bool merged = false;
+        for(unsigned int r = firstOpen; r < regions.size() && !merged; ++r) {
+            CandidateRegion & region = regions[r];
+            if(roi_ul.x >= region.lr.x || region.ul.x >= roi_lr.x ||
+               roi_ul.y >= region.lr.y || region.ul.y >= roi_lr.y) {
+                continue; // no overlap
+            }
+            Diff2D ul (std::min(region.ul.x, roi_ul.x), std::min(region.ul.y, roi_ul.y));
+            Diff2D lr (std::max(region.lr.x, roi_lr.x), std::max(region.lr.y, roi_lr.y));
+            if(lr.x-ul.x > maxlen || lr.y-ul.y > maxlen) {
+                continue; // region would get too large
+            }
+            region.ul = ul;
+            region.lr = lr;
+            nextMember[region.last] = k;
+            region.last = k;
+            merged = true;
+        }
+        if(!merged) {
+            regions.push_back(CandidateRegion(roi_ul, roi_lr, k));
+        }
+    }
+}
+
+/**
+ * One region per ROI, i.e. the regions of mergeCandidateRegions() 
+ * without merging.
+ */
+template <class Image, class T>
+void splitCandidateRegions(const Image& filtered, const Image& bg, const T baseline,
+            const std::vector<Coord<T> >& candidates, const int mylen,
+            std::vector<CandidateRegion>& regions, std::vector<int>& nextMember) {
+    regions.clear();
+    nextMember.assign(candidates.size(), -1);
+    for(unsigned int k = 0; k < candidates.size(); ++k) {
+        const Coord<T>& c = candidates[k];
+        if(filtered(c.x,c.y)<(bg(c.x,c.y)-baseline)) { // skip very low signals
+            continue;
+        }
+        Diff2D roi_ul, roi_lr;
+        candidateROI(c, mylen, filtered.size(), roi_ul, roi_lr);
+        regions.push_back(CandidateRegion(roi_ul, roi_lr, k));
+    }
+}
+
+/**
+ * Choose how the spline method upsamples the candidates of a frame 
+ * (given the merged regions): ROI by ROI, in merged regions or the 
+ * whole frame at once.
+ *
+ * The spline is local, so all strategies find the same maxima. The 
+ * cost is estimated as the number of upsampled samples plus a fixed 
+ * overhead per upsampled block. In sparse frames, the ROIs are 
+ * upsampled on their own. Where they overlap, the merged regions 
+ * are cheaper, unless their bounding boxes are larger than the ROIs.
+ * If the ROIs cover most of the frame, the whole frame is upsampled,
+ * as long as it does not get too large.
+ */
+template <class Image, class T>
+UpsamplingChoice chooseUpsampling(const Image& filtered, const Image& bg, const T baseline,
+            const std::vector<Coord<T> >& candidates, const std::vector<CandidateRegion>& regions, 
+            const int mylen, const int factor) {
+    const double overhead = 1024.;           // per block, in samples
+    const double maxFrameSamples = 1 << 22; // 16 MB for float
+    const Diff2D size = filtered.size();
+    double roiCost = 0., roiArea = 0.;
+    int count = 0;
+    for(unsigned int k = 0; k < candidates.size(); ++k) {
+        const Coord<T>& c = candidates[k];
+        if(filtered(c.x,c.y)<(bg(c.x,c.y)-baseline)) { // skipped, as in mergeCandidateRegions()
+            continue;
+        }
+        Diff2D roi_ul, roi_lr;
+        candidateROI(c, mylen, size, roi_ul, roi_lr);
+        const Diff2D roi = roi_lr-roi_ul;
+        roiCost += (double)(factor*(roi.x-1)+1)*(factor*(roi.y-1)+1) + overhead;
+        roiArea += (double)roi.x*roi.y;
+        ++count;
+    }
+    double regionCost = 0.;
+    for(unsigned int r = 0; r < regions.size(); ++r) {
+        const Diff2D region = regions[r].lr-regions[r].ul;
+        regionCost += (double)(factor*(region.x-1)+1)*(factor*(region.y-1)+1) + overhead;
+    }
+    const double frameSamples = (double)(factor*(size.x-1)+1)*(factor*(size.y-1)+1);
+    const double frameCost = frameSamples + overhead;
+
+    UpsamplingChoice choice(REGION_UPSAMPLING, count, roiArea/((double)size.x*size.y));
+    if(roiCost < regionCost) {
+        choice.strategy = ROI_UPSAMPLING;
+    }
+    if(count > 0 && size.x > 1 && size.y > 1 && frameSamples <= maxFrameSamples && 
+            frameCost < std::min(roiCost, regionCost)) {
+        choice.strategy = FRAME_UPSAMPLING;
+    }
+    return choice;
+}
+
+/**
+ * Name of an upsampling strategy, as printed with --verbose
+ */
+inline const char * upsamplingStrategyName(const UpsamplingStrategy strategy) {
+    switch(strategy) {
+        case ROI_UPSAMPLING:
+            return "rois";
+        case FRAME_UPSAMPLING:
+            return "frame";
+        case REGION_UPSAMPLING:
+        default:
+            return "regions";
+    }
+}
+
+/**
+ * Print the upsampling strategies chosen for a frame (one per tile)
+ */
+inline void printUpsamplingChoices(const int frame, const std::vector<UpsamplingChoice>& choices) {
+    #pragma omp critical
+    {
+    std::cout << "frame " << frame << ":";
+    for(unsigned int i = 0; i < choices.size(); ++i) {
+        std::cout << (i ? "," : "") << " " << choices[i].candidates << " candidates, coverage " 
+            << std::fixed << std::setprecision(2) << choices[i].coverage << std::setprecision(6)
+            << " -> " << upsamplingStrategyName(choices[i].strategy);
+    }
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::endl;
+    }
+}
+
+/**
+ * Upsample the whole frame with the spline and search the maxima in
+ * the window of every ROI, i.e. the same area as for the regions.
+ * The frame is split into bands of rows for workspace.threads() threads.
+ * The maxima are appended in the order of the candidates (not unique).
+ */
+template <class Image, class T>
+void upsampleFrame(const Image& filtered, const Image& bg, const T baseline,
+            const std::vector<Coord<T> >& candidates, std::vector<Coord<T> >& maxima_coords,
+            const T threshold, const int factor, const int mylen, FrameWorkspace<T>& workspace) {
+    typedef typename FrameWorkspace<T>::ImageView ImageView;
+    const Diff2D size_xxl = (filtered.size()-Diff2D(1,1))*factor+Diff2D(1,1);
+    ImageView frame_xxl(workspace.upsampledFrame().data(), size_xxl);
+    const int bands = workspace.threads();
+    #pragma omp parallel for num_threads(bands) if(bands > 1) schedule(static)
+    for(int b = 0; b < bands; ++b) {
+        const int y0 = b*size_xxl.y/bands;
+        const int y1 = (b+1)*size_xxl.y/bands;
+        if(y1 > y0) {
+            ImageView band(frame_xxl.data()+y0*size_xxl.x, size_xxl.x, y1-y0);
+            workspace.regionWorkspace().splineUpsampling.upsample(
+                srcImageRange(filtered), destImageRange(band), Diff2D(0, y0));
+        }
+    }
+
+    const int ncandidates = candidates.size();
+    std::vector<std::vector<Coord<T> > > & taskMaxima = workspace.taskMaxima;
+    if((int)taskMaxima.size() < ncandidates) {
+        taskMaxima.resize(ncandidates);
+    }
+    #pragma omp parallel for num_threads(workspace.threads()) if(workspace.threads() > 1) schedule(dynamic, 16)
+    for(int k = 0; k < ncandidates; ++k) {
+        std::vector<Coord<T> > & found = taskMaxima[k];
+        found.clear();
+        const Coord<T>& c = candidates[k];
+        if(filtered(c.x,c.y)<(bg(c.x,c.y)-baseline)) { // skip very low signals
+            continue;
+        }
+        // the window of the ROI excludes one pixel at the upper left 
+        // and two at the lower right border, see localizeCandidates()
+        Diff2D roi_ul, roi_lr;
+        candidateROI(c, mylen, filtered.size(), roi_ul, roi_lr);
+        Diff2D ul = (roi_ul+Diff2D(1,1))*factor;
+        Diff2D lr = (roi_lr-Diff2D(2,2))*factor+Diff2D(1,1);
+        pushLocalMaxima(frame_xxl, ul, lr, threshold, ul, 
+                workspace.regionWorkspace().maximaIndices, found);
+    }
+    for(int k = 0; k < ncandidates; ++k) {
+        maxima_coords.insert(maxima_coords.end(), taskMaxima[k].begin(), taskMaxima[k].end());
+    }
+}
+
+/**
+ * Upsample only the neighbourhood of +-radius pixels around every 
+ * candidate with the (not prefiltered) cubic spline and find the maxima there.
+ *
+ * The true maximum is next to the candidate pixel, so the rest of the
+ * ROI of the spline method does not need to be interpolated. The source 
+ * ROI is extended by the support of the spline (2 pixels), therefore the
+ * values are the same as in the upsampled ROI of the spline method, 
+ * but only (2*radius*factor+3)^2 instead of ((mylen-1)*factor+1)^2 
+ * samples are computed per candidate.
+ * The candidates are distributed over workspace.threads() threads.
+ */
+template <class Image, class T>
+void upsampleCandidatePeaks(const Image& filtered, const Image& bg, const T baseline,
+            const std::vector<Coord<T> >& candidates, std::vector<Coord<T> >& maxima_coords,
+            const T threshold, const int factor, const int radius, FrameWorkspace<T>& workspace) {
+    typedef typename FrameWorkspace<T>::ImageView ImageView;
+    const int roilen = 2*(radius+2)+1;
+    const int reach = radius*factor+1; // window and one sample for the maximum test
+    const int ncandidates = candidates.size();
+    std::vector<std::vector<Coord<T> > > & taskMaxima = workspace.taskMaxima;
+    if((int)taskMaxima.size() < ncandidates) {
+        taskMaxima.resize(ncandidates);
+    }
+    #pragma omp parallel for num_threads(workspace.threads()) if(workspace.threads() > 1) schedule(dynamic, 16)
+    for(int k = 0; k < ncandidates; ++k) {
+        const Coord<T>& c = candidates[k];
+        std::vector<Coord<T> > & found = taskMaxima[k];
+        found.clear();
+        if(filtered(c.x,c.y)<(bg(c.x,c.y)-baseline)) { // skip very low signals
+            continue;
+        }
+        RegionWorkspace<T> & rw = workspace.regionWorkspace();
+        Diff2D roi_ul, roi_lr;
+        candidateROI(c, roilen, filtered.size(), roi_ul, roi_lr);
+        // window around the candidate within the upsampled ROI
+        Diff2D center = (Diff2D((int)c.x, (int)c.y)-roi_ul)*factor;
+        Diff2D size_xxl = (roi_lr-roi_ul-Diff2D(1,1))*factor+Diff2D(1,1);
+        Diff2D win_ul(std::max(center.x-reach, 0), std::max(center.y-reach, 0));
+        Diff2D win_lr(std::min(center.x+reach+1, size_xxl.x), std::min(center.y+reach+1, size_xxl.y));
+        ImageView window(rw.im_xxl.data(), win_lr-win_ul);
+        rw.splineUpsampling.upsample(
+            srcIterRange(filtered.upperLeft()+roi_ul, filtered.upperLeft()+roi_lr), 
+            destImageRange(window), win_ul);
+
+        rw.regionMaxima.clear();
+        pushLocalMaxima(window, Diff2D(0,0), window.size(), threshold, 
+                roi_ul*factor+win_ul, rw.maximaIndices, rw.regionMaxima);
+        // same border handling as the spline method
+        for(unsigned int i = 0; i < rw.regionMaxima.size(); ++i) {
+            const Coord<T>& m = rw.regionMaxima[i];
+            if(m.x > factor*(roi_ul.x+1) && m.x < factor*(roi_lr.x-2) &&
+               m.y > factor*(roi_ul.y+1) && m.y < factor*(roi_lr.y-2)) {
+                found.push_back(m);
+            }
+        }
+    }
+    for(int k = 0; k < ncandidates; ++k) {
+        maxima_coords.insert(maxima_coords.end(), taskMaxima[k].begin(), taskMaxima[k].end());
+    }
+    squeezeDuplicates(maxima_coords, workspace.sortBuffer);
+    determineAsymmetry(srcImageRange(filtered), maxima_coords, factor, workspace.splineHessian);
+}
+
+/**
+ * Localize the maxima by Newton iterations on the (not prefiltered)
+ * cubic spline of the filtered frame, starting at every candidate.
+ *
+ * The spline method samples the same function on the upsampled grid,
+ * here the positions are continuous and do not depend on factor.
+ * factor only scales the coordinates to the units of the upsampled image.
+ * The spline is only evaluated in the 4x4 neighbourhoods of the Newton 
+ * steps.
+ */
+template <class Image, class T>
+void refineCandidatesNewton(const Image& filtered, const Image& bg, const T baseline,
+            const std::vector<Coord<T> >& candidates, std::vector<Coord<T> >& maxima_coords,
+            const T threshold, const int factor, FrameWorkspace<T>& workspace) {
+    LocalSplineView<Image> sview(filtered);
+    typename std::vector<Coord<T> >::const_iterator it2;
+    for(it2 = candidates.begin(); it2 != candidates.end(); it2++) {
+        const Coord<T>& c = *it2;
+        if(filtered(c.x,c.y)<(bg(c.x,c.y)-baseline)) { // skip very low signals
+            continue;
+        }
+        double x = c.x;
+        double y = c.y;
+        T val = refinePeakNewton(sview, x, y);
+        if(val > threshold) {
+            maxima_coords.push_back(Coord<T>(factor*x, factor*y, val));
+        }
+    }
+    squeezeDuplicates(maxima_coords, workspace.sortBuffer);
+    determineAsymmetry(srcImageRange(filtered), maxima_coords, factor, workspace.splineHessian);
+}
+
+/**
+ * Quick look: refine every candidate by a parabola through the 3x3 
+ * neighbourhood of the candidate pixel (separately in x and y).
+ *
+ * Nothing is upsampled, so this is much faster than the other methods,
+ * but less precise. The asymmetry is taken from the finite differences
+ * of the same neighbourhood. Meant for previews, e.g. to decide during 
+ * an acquisition whether a measurement is worth continuing.
+ */
+template <class Image, class T>
+void refineCandidatesParabola(const Image& filtered, const Image& bg, const T baseline,
+            const std::vector<Coord<T> >& candidates, std::vector<Coord<T> >& maxima_coords,
+            const T threshold, const int factor, FrameWorkspace<T>& workspace) {
+    typename std::vector<Coord<T> >::const_iterator it2;
+    for(it2 = candidates.begin(); it2 != candidates.end(); it2++) {
+        const Coord<T>& c = *it2;
+        const int x = (int)c.x;
+        const int y = (int)c.y;
+        if(filtered(x,y)<(bg(x,y)-baseline)) { // skip very low signals
+            continue;
+        }
+        // candidates are local maxima, so they are not at the border
+        // and the second derivatives are negative (or zero)
+        const T v = filtered(x,y);
+        const T dx = (filtered(x+1,y) - filtered(x-1,y)) / 2;
+        const T dy = (filtered(x,y+1) - filtered(x,y-1)) / 2;
+        const T dxx = filtered(x+1,y) - 2*v + filtered(x-1,y);
+        const T dyy = filtered(x,y+1) - 2*v + filtered(x,y-1);
+        const T dxy = (filtered(x+1,y+1) - filtered(x-1,y+1) 
+                     - filtered(x+1,y-1) + filtered(x-1,y-1)) / 4;
+        const T ox = (dxx < 0) ? std::max(T(-0.5), std::min(T(0.5), -dx/dxx)) : T(0);
+        const T oy = (dyy < 0) ? std::max(T(-0.5), std::min(T(0.5), -dy/dyy)) : T(0);
+        const T val = v + (dx*ox + dy*oy) / 2; // vertex of the parabolas
+        if(val > threshold) {
+            maxima_coords.push_back(Coord<T>(factor*(x+ox), factor*(y+oy), val, 
+                    hessianAsymmetry(dxx, dyy, dxy)));
+        }
+    }
+    squeezeDuplicates(maxima_coords, workspace.sortBuffer);
+}
+
+/**
+ * Fit a Gaussian PSF to the raw data around every candidate.
+ * 
+ * The ROIs of size workspace.gaussianFit().roilen() are shifted to lie completely
+ * inside the frame and collected in batches that are fitted together.
+ * The uncertainty of each position is set to the Cramer-Rao bound.
+ */
+template <class Image, class T>
+void fitCandidatesMLE(const Image& raw, const Image& filtered, const Image& bg, const T baseline,
+            const std::vector<Coord<T> >& candidates, std::vector<Coord<T> >& maxima_coords,
+            const int factor, FrameWorkspace<T>& workspace) {
+    GaussianFit<T>& fitter = workspace.gaussianFit();
+    const int len = fitter.roilen();
+    const int len2 = len/2;
+    vigra_precondition(raw.width() >= len && raw.height() >= len,
+        "fitCandidatesMLE(): frame smaller than the ROI.");
+    fitter.clear();
+    typename std::vector<Coord<T> >::const_iterator it2;
+    for(it2 = candidates.begin(); it2 != candidates.end(); ) {
+        const Coord<T>& c = *it2;
+        ++it2;
+        if(filtered(c.x,c.y)>=(bg(c.x,c.y)-baseline)) { // skip very low signals
+            int x0 = std::min(std::max((int)c.x-len2, 0), raw.width()-len);
+            int y0 = std::min(std::max((int)c.y-len2, 0), raw.height()-len);
+            fitter.addSpot(raw, x0, y0, c.x, c.y);
+        }
+        if(fitter.full() || (it2 == candidates.end() && fitter.size() > 0)) {
+            fitter.fit();
+            for(int i = 0; i < fitter.size(); ++i) {
+                if(!fitter.valid(i)) {
+                    continue;
+                }
+                Coord<T> cc(factor*fitter.x(i), factor*fitter.y(i), fitter.intensity(i));
+                cc.uncertainty = fitter.uncertainty(i);
+                maxima_coords.push_back(cc);
+            }
+            fitter.clear();
+        }
+    }
+    squeezeDuplicates(maxima_coords, workspace.sortBuffer);
+    determineAsymmetry(srcImageRange(filtered), maxima_coords, factor, workspace.splineHessian);
+}
+
+/**
+ * Split numThreads threads between the frames and the work within a 
+ * frame (FFT, background, ROIs).
+ *
+ * Frames are processed in parallel as far as possible. About a quarter
+ * of the work within a frame is serial, i.e. k threads per frame give
+ * a speedup of k/(1+(k-1)/4). Short stacks of large frames use the 
+ * remaining threads per frame: frameThreads minimizes 
+ * ceil(numFrames/frameThreads) / speedup(innerThreads).
+ */
+inline void balanceThreads(const int numFrames, const int numThreads, 
+            int& frameThreads, int& innerThreads) {
+    frameThreads = 1;
+    innerThreads = std::max(1, numThreads);
+    double best = -1.;
+    for(int f = std::max(1, std::min(numThreads, numFrames)); f >= 1; --f) {
+        int inner = std::max(1, numThreads/f);
+        double rounds = (std::max(numFrames, 1)+f-1)/f;
+        double cost = rounds * (1. + 0.25*(inner-1)) / inner;
+        if(best < 0. || cost < best-1e-9) { // ties: more frames in parallel
+            best = cost;
+            frameThreads = f;
+            innerThreads = inner;
+        }
+    }
+}
+
+/**
+ * First of the frames beg, beg+stride, ... that is not before resumeFrame
+ */
+inline int firstFrameToProcess(const int beg, const int stride, const int resumeFrame) {
+    if(resumeFrame <= beg) {
+        return beg;
+    }
+    return beg + (resumeFrame-beg+stride-1)/stride*stride;
+}
+
+#ifdef STORM_COUNT_ALLOCATIONS
+/**
+ * Localize a frame a second time with the same workspace and check
+ * that this does not allocate any memory (see allocationcounter.hxx): 
+ * all buffers and vectors have grown to the frame in the first pass.
+ * The count is only exact if no other thread allocates at the same 
+ * time, so the check is skipped for more than one frame thread.
+ */
+template <class T>
+void checkFrameAllocations(const MultiArrayView<2, T>& in, const BasicImage<T>& filter, 
+            std::vector<Coord<T> >& maxima_coords, FFTFilter<T> & fftwWrapper,
+            FrameWorkspace<T> & workspace, const T threshold, const int factor, const int mylen,
+            const StormOptions& options, const BasicImage<T> * background, 
+            const FrameTiling<T> * tiling, const int frameThreads) {
+    if(frameThreads > 1) {
+        return;
+    }
+    const unsigned int spots = maxima_coords.size();
+    const unsigned long before = allocationCount();
+    maxima_coords.clear();
+    wienerStormSingleFrame(in, filter, maxima_coords, fftwWrapper, workspace,
+            threshold, factor, mylen, 0, options, background, tiling);
+    vigra_postcondition(allocationCount() == before && maxima_coords.size() == spots,
+        "checkFrameAllocations(): localizing a frame allocated memory.");
+}
+#endif // STORM_COUNT_ALLOCATIONS
+
 /**
  * Localize Maxima of the spots and return a list with coordinates
  * 
@@ -489,9 +1168,10 @@ void prefilterBSpline(Image& im) {
  */
 template <class T>
 void wienerStorm(const MultiArrayView<3, T>& im, const BasicImage<T>& filter, 
-            std::vector<std::set<Coord<T> > >& maxima_coords, 
+            std::vector<std::vector<Coord<T> > >& maxima_coords, 
             const T threshold=800, const int factor=8, const int mylen=9,
-            const std::string &frames="", const char verbose=0) {
+            const std::string &frames="", const char verbose=0,
+            const StormOptions& options=StormOptions()) {
     
     unsigned int stacksize = im.size(2);
     unsigned int w = im.size(0);
@@ -512,33 +1192,156 @@ void wienerStorm(const MultiArrayView<3, T>& im, const BasicImage<T>& filter,
     // filter must have the size of input
 
 
+    // frames before options.resumeFrame are done (by an earlier run)
+    const int r_beg = firstFrameToProcess(i_beg, i_stride, options.resumeFrame);
+
+    // split the threads between frames and the work within a frame
+    // (for the whole range, so that a resumed run splits them as the first)
+    int frameThreads = 1, innerThreads = 1;
+    #ifdef OPENMP_FOUND
+    const int numFrames = (i_end-i_beg+(int)i_stride-1)/(int)i_stride;
+    balanceThreads(numFrames, omp_get_max_threads(), frameThreads, innerThreads);
+    omp_set_nested(innerThreads > 1);
+    #endif //OPENMP_FOUND
+    // transforms of small frames are not worth splitting
+    const int fftThreads = (w*h >= 512*512) ? innerThreads : 1;
+    if(verbose) {
+        std::cout << "threads: " << frameThreads << " frames x " << innerThreads 
+            << " per frame" << std::endl;
+    }
+
     // initialize fftw-wrapper; create plans
     BasicImageView<T> sampleinput = makeBasicImageView(im.bindOuter(0));  // access first frame as BasicImage
-    FFTFilter<T> fftwWrapper(sampleinput);
+    FFTFilter<T> fftwWrapper(srcImageRange(sampleinput), fftThreads);
 
     std::cout << "Finding the maximum spots in the images..." << std::endl;
     helper::progress(-1,-1); // reset progress
 
+    // the temporal background is updated by one thread in batches of frames,
+    // all threads process a batch with the same (filtered) snapshot of the model.
+    // On resume, the model is updated with the frames that are done as well.
+    const bool temporal = (options.background == TEMPORAL_BACKGROUND);
+    TemporalBackground<T> bgModel(temporal ? w : 0, temporal ? h : 0);
+    BasicImage<T> bgFiltered(temporal ? w : 0, temporal ? h : 0);
+    const int batch = temporal ? bgModel.updateInterval()*i_stride : i_end-i_beg;
+
+    // large frames are processed in tiles, so that the memory per thread
+    // is bounded by the tile size
+    const bool tiled = options.tileSize > 0 && 
+        ((int)w > options.tileSize || (int)h > options.tileSize);
+    FrameTiling<T> * tiling = 0;
+    if(tiled) {
+        tiling = new FrameTiling<T>(filter, fftwWrapper, options.tileSize, 
+                tileHalo(mylen, options.background), tileFilterRadius(options.psfWidth, options.tileSize));
+        if(verbose) {
+            std::cout << "processing " << tiling->size() << " tiles per frame, halo " << tiling->halo()
+                << " px, filter radius " << tiling->filterRadius() << " px" << std::endl;
+        }
+        if(tiling->truncationError() > tiling->tolerance()) {
+            std::cout << "warning: the filter is truncated to " << tiling->filterRadius() 
+                << " px on the tiles, the error is " << tiling->truncationError() 
+                << " of the peak." << std::endl;
+        }
+    }
+
+    // on several NUMA nodes, the frame threads are grouped by node
+    const ThreadPlacement placement(numaTopology(), frameThreads);
+    NodeReplicas<BasicImage<T> > filters(filter, placement.nodes());
+    if(verbose) {
+        placement.print(std::cout);
+    }
+
     //over all images in stack
-    #pragma omp parallel for schedule(static, CHUNKSIZE)
-    for(int i = i_beg; i < i_end; i+=i_stride) {
+    FrameScheduler scheduler(frameThreads);
+    scheduler.setNodes(placement.nodeOfThreads());
+    InMemoryFrames noReader;
+    unsigned int allocations = 0;
+    #pragma omp parallel num_threads(frameThreads)
+    {
+    #ifdef OPENMP_FOUND
+    const int thread = omp_get_thread_num();
+    #else
+    const int thread = 0;
+    #endif //OPENMP_FOUND
+    placement.bind(thread);
+    const int node = placement.node(thread);
+    if(placement.leader(thread)) {
+        filters.replicate(node); // placed on the node
+    }
+    #pragma omp barrier
+    const BasicImage<T>& localFilter = filters.local(node);
+    FrameWorkspace<T> workspace; // one per thread, shaped for the frame or the tiles
+    workspace.setThreads(innerThreads);
+    std::vector<Coord<T> > frameCoords; // keeps its capacity, copied to maxima_coords
+    for(int b_beg = i_beg; b_beg < i_end; b_beg += batch) {
+    const int b_end = std::min(b_beg+batch, i_end);
+    #pragma omp single
+    {
+    if(temporal) {
+        for(int i = b_beg; i < b_end; i+=i_stride) {
+            bgModel.update(makeBasicImageView(im.bindOuter(i)));
+        }
+        if(b_end > r_beg) {
+            fftwWrapper.applyFourierFilter(srcImageRange(bgModel.estimate()), srcImage(filter),
+                    destImage(bgFiltered));
+        }
+    }
+    scheduler.reset(std::max(b_beg, r_beg), b_end, i_stride);
+    }
+    int i, slot;
+    while(scheduler.next(thread, noReader, i, slot)) {
         MultiArrayView <2, T> array = im.bindOuter(i); // select current image
 
-        wienerStormSingleFrame(array, filter, maxima_coords[i], 
+        frameCoords.clear();
+        wienerStormSingleFrame(array, localFilter, frameCoords, 
                 fftwWrapper, // TODO (this is no real function argument but should be global)
-                threshold, factor, mylen, verbose);
+                workspace, threshold, factor, mylen, verbose, options,
+                temporal ? &bgFiltered : 0, tiling);
+        #ifdef STORM_COUNT_ALLOCATIONS
+        checkFrameAllocations(array, localFilter, frameCoords, fftwWrapper, workspace,
+                threshold, factor, mylen, options, temporal ? &bgFiltered : 0, tiling, frameThreads);
+        #endif // STORM_COUNT_ALLOCATIONS
+        maxima_coords[i] = frameCoords;
+        scheduler.release(slot);
+        if(verbose > 1) {
+            printUpsamplingChoices(i, workspace.upsamplingChoices);
+        }
 
-        #ifdef OPENMP_FOUND
-        if(omp_get_thread_num()==0) { // master thread
+        if(thread == 0) { // master thread
             helper::progress(i+1, i_end); // update progress bar
         }
-        #else
-            helper::progress(i+1, i_end); // update progress bar
-        #endif //OPENMP_FOUND       
     }
+    #pragma omp barrier
+    } // batch
+    #pragma omp atomic
+    allocations += workspace.allocations();
+    placement.unbind();
+    }
+    delete tiling;
     std::cout << std::endl;
+    if(verbose) {
+        std::cout << "workspace buffers allocated: " << allocations << std::endl;
+        scheduler.printMetrics(std::cout);
+    }
 }
 
+/**
+ * Read frames of a file into the buffer slots of a FrameScheduler
+ */
+template <class T>
+class FrameFileReader {
+public:
+    FrameFileReader(const MyImportInfo& info, std::vector<MultiArray<3, T> >& buffers)
+        : m_info(info), m_buffers(buffers) {  }
+    void operator()(const int frame, const int slot) {
+        MultiArray<3, T>& buffer = m_buffers[slot];
+        readBlock(m_info, Shape3(0,0,frame), buffer.shape(), buffer);
+    }
+private:
+    const MyImportInfo& m_info;
+    std::vector<MultiArray<3, T> >& m_buffers;
+};
+
 /**
  * Localize Maxima of the spots and return a list with coordinates
  * 
@@ -548,12 +1351,15 @@ void wienerStorm(const MultiArrayView<3, T>& im, const BasicImage<T>& filter,
  * The localization is done on per-frame basis in wienerStormSingleFrame()
  * 
  * @param info MyImportInfo file info containing the image stack
+ * @param results receives the coordinates frame by frame, in the 
+ *        order of the stack (while the stack is processed)
  */
 template <class T>
 void wienerStorm(const MyImportInfo& info, const BasicImage<T>& filter, 
-            std::vector<std::set<Coord<T> > >& maxima_coords, 
+            FrameSink<Coord<T> >& results, 
             const T threshold=800, const int factor=8, const int mylen=9,
-            const std::string &frames="", const char verbose=0) {
+            const std::string &frames="", const char verbose=0,
+            const StormOptions& options=StormOptions()) {
 
     unsigned int stacksize = info.shape(2);
     unsigned int w = info.shape(0);
@@ -574,113 +1380,416 @@ void wienerStorm(const MyImportInfo& info, const BasicImage<T>& filter,
     // filter must have the size of input
     MultiArray<3, T> im(Shape3(w,h,1));
 
+    // frames before options.resumeFrame are done (by an earlier run)
+    const int r_beg = firstFrameToProcess(i_beg, i_stride, options.resumeFrame);
+
+    // split the threads between frames and the work within a frame
+    // (for the whole range, so that a resumed run splits them as the first)
+    int frameThreads = 1, innerThreads = 1;
+    #ifdef OPENMP_FOUND
+    const int numFrames = (i_end-i_beg+(int)i_stride-1)/(int)i_stride;
+    balanceThreads(numFrames, omp_get_max_threads(), frameThreads, innerThreads);
+    omp_set_nested(innerThreads > 1);
+    #endif //OPENMP_FOUND
+    // transforms of small frames are not worth splitting
+    const int fftThreads = (w*h >= 512*512) ? innerThreads : 1;
+    if(verbose) {
+        std::cout << "threads: " << frameThreads << " frames x " << innerThreads 
+            << " per frame" << std::endl;
+    }
+
     // initialize fftw-wrapper; create plans
     readBlock(info, Shape3(0,0,0), Shape3(w,h,1), im);
     BasicImageView<T> sampleinput = makeBasicImageView(im.bindOuter(0));  // access first frame as BasicImage
-    FFTFilter<T> fftwWrapper(srcImageRange(sampleinput));
+    FFTFilter<T> fftwWrapper(srcImageRange(sampleinput), fftThreads);
 
     #ifndef STORM_QT // silence stdout
     std::cout << "Finding the maximum spots in the images..." << std::endl;
     #endif // STORM_QT
     helper::progress(-1,-1); // reset progress
 
-    //over all images in stack
-    #pragma omp parallel for schedule(static, CHUNKSIZE) firstprivate(im)
-    for(int i = i_beg; i < i_end; i+=i_stride) {
-        readBlock(info, Shape3(0,0,i), Shape3(w,h,1), im);
-        MultiArrayView <2, T> array = im.bindOuter(0); // select current image
+    // the temporal background is updated by one thread in batches of frames,
+    // all threads process a batch with the same (filtered) snapshot of the model.
+    // On resume, the model is updated with the frames that are done as well.
+    const bool temporal = (options.background == TEMPORAL_BACKGROUND);
+    TemporalBackground<T> bgModel(temporal ? w : 0, temporal ? h : 0);
+    BasicImage<T> bgFiltered(temporal ? w : 0, temporal ? h : 0);
+    const int batch = temporal ? bgModel.updateInterval()*i_stride : i_end-i_beg;
+
+    // large frames are processed in tiles, so that the memory per thread
+    // is bounded by the tile size
+    const bool tiled = options.tileSize > 0 && 
+        ((int)w > options.tileSize || (int)h > options.tileSize);
+    FrameTiling<T> * tiling = 0;
+    if(tiled) {
+        tiling = new FrameTiling<T>(filter, fftwWrapper, options.tileSize, 
+                tileHalo(mylen, options.background), tileFilterRadius(options.psfWidth, options.tileSize));
+        if(verbose) {
+            std::cout << "processing " << tiling->size() << " tiles per frame, halo " << tiling->halo()
+                << " px, filter radius " << tiling->filterRadius() << " px" << std::endl;
+        }
+        if(tiling->truncationError() > tiling->tolerance()) {
+            std::cout << "warning: the filter is truncated to " << tiling->filterRadius() 
+                << " px on the tiles, the error is " << tiling->truncationError() 
+                << " of the peak." << std::endl;
+        }
+    }
+
+    // on several NUMA nodes, the frame threads are grouped by node
+    const ThreadPlacement placement(numaTopology(), frameThreads);
+    NodeReplicas<BasicImage<T> > filters(filter, placement.nodes());
+    #ifndef STORM_QT // silence stdout
+    if(verbose) {
+        placement.print(std::cout);
+    }
+    #endif // STORM_QT
+
+    //over all images in stack, the frames are read by one thread at a time
+    FrameScheduler scheduler(frameThreads);
+    scheduler.setNodes(placement.nodeOfThreads());
+    std::vector<MultiArray<3, T> > buffers(scheduler.slots()); // shaped by scheduler.slotOwner()
+    FrameFileReader<T> reader(info, buffers);
+    OrderedFrameWriter<Coord<T> > writer(results, scheduler, r_beg, i_end, i_stride);
+    unsigned int allocations = 0;
+    #pragma omp parallel num_threads(frameThreads)
+    {
+    #ifdef OPENMP_FOUND
+    const int thread = omp_get_thread_num();
+    #else
+    const int thread = 0;
+    #endif //OPENMP_FOUND
+    placement.bind(thread);
+    const int node = placement.node(thread);
+    if(placement.leader(thread)) {
+        filters.replicate(node); // placed on the node
+    }
+    for(int s = 0; s < scheduler.slots(); ++s) {
+        if(scheduler.slotOwner(s) == thread) {
+            buffers[s].reshape(Shape3(w,h,1)); // first written on the node that uses it
+        }
+    }
+    #pragma omp barrier
+    const BasicImage<T>& localFilter = filters.local(node);
+    FrameWorkspace<T> workspace; // one per thread, shaped for the frame or the tiles
+    workspace.setThreads(innerThreads);
+    std::vector<Coord<T> > frameCoords; // handed over to the writer
+    for(int b_beg = i_beg; b_beg < i_end; b_beg += batch) {
+    const int b_end = std::min(b_beg+batch, i_end);
+    #pragma omp single
+    {
+    if(temporal) {
+        for(int i = b_beg; i < b_end; i+=i_stride) {
+            readBlock(info, Shape3(0,0,i), Shape3(w,h,1), im);
+            bgModel.update(makeBasicImageView(im.bindOuter(0)));
+        }
+        if(b_end > r_beg) {
+            fftwWrapper.applyFourierFilter(srcImageRange(bgModel.estimate()), srcImage(filter),
+                    destImage(bgFiltered));
+        }
+    }
+    scheduler.reset(std::max(b_beg, r_beg), b_end, i_stride);
+    }
+    int i, slot;
+    while(scheduler.next(thread, reader, i, slot)) {
+        MultiArrayView <2, T> array = buffers[slot].bindOuter(0); // select current image
 
-        wienerStormSingleFrame(array, filter, maxima_coords[i], 
+        frameCoords.clear();
+        wienerStormSingleFrame(array, localFilter, frameCoords, 
                 fftwWrapper, // TODO (this is no real function argument but should be global)
-                threshold, factor, mylen, verbose);
+                workspace, threshold, factor, mylen, verbose, options,
+                temporal ? &bgFiltered : 0, tiling);
+        #ifdef STORM_COUNT_ALLOCATIONS
+        checkFrameAllocations(array, localFilter, frameCoords, fftwWrapper, workspace,
+                threshold, factor, mylen, options, temporal ? &bgFiltered : 0, tiling, frameThreads);
+        #endif // STORM_COUNT_ALLOCATIONS
+        if(verbose > 1) {
+            printUpsamplingChoices(i, workspace.upsamplingChoices);
+        }
+        writer.submit(i, frameCoords, slot); // releases the slot when written
 
-        #ifdef OPENMP_FOUND
-        if(omp_get_thread_num()==0) { // master thread
+        if(thread == 0) { // master thread
             helper::progress(i+1, i_end); // update progress bar
         }
-        #else
-            helper::progress(i+1, i_end); // update progress bar
-        #endif //OPENMP_FOUND       
     }
+    #pragma omp barrier
+    } // batch
+    #pragma omp atomic
+    allocations += workspace.allocations();
+    placement.unbind();
+    }
+    writer.finish();
+    delete tiling;
     #ifndef STORM_QT // silence stdout
     std::cout << std::endl;
+    if(verbose) {
+        // image buffers of the workspaces, allocated when they are reshaped 
+        // (once per thread) or at their first use
+        std::cout << "workspace buffers allocated: " << allocations << std::endl;
+        scheduler.printMetrics(std::cout);
+    }
     #endif // STORM_QT
 }
 
+/**
+ * Localize Maxima of the spots and return a list with coordinates,
+ * see above. maxima_coords must have an entry for every frame of the stack.
+ */
+template <class T>
+void wienerStorm(const MyImportInfo& info, const BasicImage<T>& filter, 
+            std::vector<std::vector<Coord<T> > >& maxima_coords, 
+            const T threshold=800, const int factor=8, const int mylen=9,
+            const std::string &frames="", const char verbose=0,
+            const StormOptions& options=StormOptions()) {
+    CoordsCollector<Coord<T> > collector(maxima_coords);
+    wienerStorm(info, filter, collector, threshold, factor, mylen, frames, verbose, options);
+}
+
+/**
+ * Localize the spots in a single frame.
+ * 
+ * Convenience version that allocates its own scratch memory. 
+ * When processing many frames, better keep a FrameWorkspace per thread.
+ */
+template <class T>
+void wienerStormSingleFrame(const MultiArrayView<2, T>& in, const BasicImage<T>& filter, 
+            std::vector<Coord<T> >& maxima_coords, 
+            FFTFilter<T> & fftwWrapper,
+            const T threshold=800, const int factor=8, const int mylen=9,
+            const char verbose=0, const StormOptions& options=StormOptions(),
+            const BasicImage<T> * background=0, const FrameTiling<T> * tiling=0) {
+    FrameWorkspace<T> workspace; // shaped for the frame or the tiles
+    wienerStormSingleFrame(in, filter, maxima_coords, fftwWrapper, workspace,
+                threshold, factor, mylen, verbose, options, background, tiling);
+}
+
+/**
+ * Localize the spots around the maximum candidates of a filtered
+ * frame (or tile) with options.method and append them to maxima_coords.
+ *
+ * raw is only used by the MLE method.
+ */
+template <class T>
+void localizeCandidates(const BasicImageView<T>& raw, const BasicImageView<T>& filtered,
+            const BasicImageView<T>& bg, const T baseline,
+            const std::vector<Coord<T> >& maxima_candidates_vect, std::vector<Coord<T> >& maxima_coords,
+            const T threshold, const int factor, const int mylen,
+            const StormOptions& options, FrameWorkspace<T> & workspace) {
+    typedef typename FrameWorkspace<T>::ImageView ImageView;
+
+    if(options.method == NEWTON_REFINEMENT) {
+        refineCandidatesNewton(filtered, bg, baseline, maxima_candidates_vect, maxima_coords,
+                threshold, factor, workspace);
+        return;
+    } else if(options.method == MLE_FIT) {
+        fitCandidatesMLE(raw, filtered, bg, baseline, maxima_candidates_vect, maxima_coords,
+                factor, workspace);
+        return;
+    } else if(options.method == QUICKLOOK_DETECTION) {
+        refineCandidatesParabola(filtered, bg, baseline, maxima_candidates_vect, maxima_coords,
+                threshold, factor, workspace);
+        return;
+    } else if(options.method == PEAK_UPSAMPLING) {
+        upsampleCandidatePeaks(filtered, bg, baseline, maxima_candidates_vect, maxima_coords,
+                threshold, factor, peakSearchRadius(options.psfWidth, mylen), workspace);
+        return;
+    }
+
+    // overlapping ROIs are merged to regions that are upsampled only once
+    std::vector<CandidateRegion> & regions = workspace.regions;
+    std::vector<int> & nextMember = workspace.nextMember;
+    mergeCandidateRegions(filtered, bg, baseline, maxima_candidates_vect, mylen, 
+            workspace.maxRegionLen(), regions, nextMember);
+
+    // the spline can also upsample the ROIs on their own or the whole 
+    // frame (with the same result), depending on the density of the 
+    // candidates. The fourier interpolation depends on the region size.
+    UpsamplingChoice choice = chooseUpsampling(filtered, bg, baseline, maxima_candidates_vect, 
+            regions, mylen, factor);
+    if(options.method == FOURIER_UPSAMPLING) {
+        choice.strategy = REGION_UPSAMPLING;
+    }
+    workspace.upsamplingChoices.push_back(choice);
+    if(choice.strategy == ROI_UPSAMPLING) {
+        splitCandidateRegions(filtered, bg, baseline, maxima_candidates_vect, mylen, 
+                regions, nextMember);
+    } else if(choice.strategy == FRAME_UPSAMPLING) {
+        regions.clear(); // no regions, the frame is one block
+        upsampleFrame(filtered, bg, baseline, maxima_candidates_vect, maxima_coords, 
+                threshold, factor, mylen, workspace);
+    }
+
+    //upscale filtered image regions with spline interpolation
+    // the regions are independent tasks for workspace.threads() threads, 
+    // their maxima are collected in the order of the regions
+    const int nregions = regions.size();
+    std::vector<std::vector<Coord<T> > > & taskMaxima = workspace.taskMaxima;
+    if((int)taskMaxima.size() < nregions) {
+        taskMaxima.resize(nregions);
+    }
+    #pragma omp parallel for num_threads(workspace.threads()) if(workspace.threads() > 1) schedule(dynamic)
+    for(int r = 0; r < nregions; ++r) {
+            const CandidateRegion & region = regions[r];
+            RegionWorkspace<T> & rw = workspace.regionWorkspace();
+            std::vector<Coord<T> > & found = taskMaxima[r];
+            found.clear();
+            ImageView region_xxl(rw.im_xxl.data(), (region.lr-region.ul-Diff2D(1,1))*factor+Diff2D(1,1));
+
+            if(options.method == FOURIER_UPSAMPLING) {
+                rw.fourierInterpolation.interpolate(
+                    srcIterRange(filtered.upperLeft()+region.ul, filtered.upperLeft()+region.lr), 
+                    destImageRange(region_xxl));
+            } else {
+                rw.splineUpsampling.upsample(
+                    srcIterRange(filtered.upperLeft()+region.ul, filtered.upperLeft()+region.lr), 
+                    destImageRange(region_xxl));
+            }
+            // find local maxima that are above a given threshold
+            // at least the values should be above background+baseline
+            // here we include only internal pixels, no border
+            Diff2D search_ul (factor, factor);
+            Diff2D search_lr = region_xxl.size()-Diff2D(factor,factor);
+            rw.regionMaxima.clear();
+            pushLocalMaxima(region_xxl, search_ul, search_lr, threshold, 
+                    search_ul+region.ul*factor,
+                    rw.maximaIndices, rw.regionMaxima);
+
+            // keep the maxima inside the search window of one of the ROIs, 
+            // i.e. the same area that is searched if every ROI is upsampled on its own.
+            // Maxima in overlapping regions are found multiple times and removed later.
+            for(unsigned int i = 0; i < rw.regionMaxima.size(); ++i) {
+                const Coord<T>& m = rw.regionMaxima[i];
+                for(int k = region.first; k >= 0; k = nextMember[k]) {
+                    Diff2D roi_ul, roi_lr;
+                    candidateROI(maxima_candidates_vect[k], mylen, filtered.size(), roi_ul, roi_lr);
+                    if(m.x > factor*(roi_ul.x+1) && m.x < factor*(roi_lr.x-2) &&
+                       m.y > factor*(roi_ul.y+1) && m.y < factor*(roi_lr.y-2)) {
+                        found.push_back(m);
+                        break;
+                    }
+                }
+            }
+    }
+    for(int r = 0; r < nregions; ++r) {
+        maxima_coords.insert(maxima_coords.end(), taskMaxima[r].begin(), taskMaxima[r].end());
+    }
+    squeezeDuplicates(maxima_coords, workspace.sortBuffer);
+    determineAsymmetry(srcImageRange(filtered), maxima_coords, factor, workspace.splineHessian);
+}
+
+/**
+ * Localize the spots in a single frame tile by tile, see FrameTiling.
+ *
+ * The workspace only holds one tile with its halo. The candidates 
+ * are searched in the core of each tile, their ROIs reach into the 
+ * halo. Maxima that are found from both sides of a seam are removed
+ * at the end. Compared to the full frame, the filter is truncated to
+ * its support and the spatial background and its minimum are estimated 
+ * per tile.
+ */
+template <class T>
+void wienerStormTiledFrame(const MultiArrayView<2, T>& in, const FrameTiling<T>& tiling,
+            std::vector<Coord<T> >& maxima_coords, FrameWorkspace<T> & workspace,
+            const T threshold, const int factor, const int mylen,
+            const StormOptions& options, const BasicImage<T> * background=0) {
+    typedef typename FrameWorkspace<T>::ImageView ImageView;
+    const Diff2D fftSize = tiling.fftSize();
+    workspace.reshape(fftSize.x, fftSize.y, factor, mylen); // no-op for all but the first frame
+    BasicImageView<T> input = makeBasicImageView(in);  // access data as BasicImage
+    ImageView & fftIn = workspace.tileBuffer(0);
+    ImageView & fftOut = workspace.tileBuffer(1);
+    std::vector<Coord<T> > & tileMaxima = workspace.tileMaxima;
+
+    for(int t = 0; t < tiling.size(); ++t) {
+        Diff2D core_ul, core_lr, area_ul, area_lr;
+        tiling.tile(t, core_ul, core_lr, area_ul, area_lr);
+        const Diff2D size = area_lr-area_ul;
+        ImageView filtered(workspace.filtered.data(), size);
+        ImageView bg(workspace.bg.data(), size);
+        ImageView raw; // only for the MLE method
+
+        tiling.filterTile(input, area_ul, area_lr, fftIn, fftOut, workspace.complexImg, filtered);
+        T baseline; // minimum of the background
+        if(background) {
+            baseline = subtractBackground(filtered, bg, *background, area_ul);
+        } else {
+            baseline = workspace.backgroundFilter.subtract(filtered, bg);
+        }
+        if(options.method == MLE_FIT) {
+            raw = ImageView(workspace.tileBuffer(2).data(), size);
+            copyImage(srcIterRange(input.upperLeft()+area_ul, input.upperLeft()+area_lr), destImage(raw));
+        }
+
+        // the search range excludes its border, i.e. only the core is searched
+        // (the border of the frame is excluded as for the full frame)
+        std::vector<Coord<T> > & candidates = workspace.candidates;
+        candidates.clear();
+        Diff2D search_ul(std::max(core_ul.x-area_ul.x-1, 0), std::max(core_ul.y-area_ul.y-1, 0));
+        Diff2D search_lr(std::min(core_lr.x-area_ul.x+1, size.x), std::min(core_lr.y-area_ul.y+1, size.y));
+        pushLocalMaxima(filtered, search_ul, search_lr, threshold, search_ul,
+                workspace.maximaIndices, candidates);
+
+        tileMaxima.clear();
+        localizeCandidates(raw, filtered, bg, baseline, candidates, tileMaxima,
+                threshold, factor, mylen, options, workspace);
+        for(unsigned int i = 0; i < tileMaxima.size(); ++i) {
+            Coord<T> c = tileMaxima[i];
+            c.x += area_ul.x*factor;
+            c.y += area_ul.y*factor;
+            maxima_coords.push_back(c);
+        }
+    }
+    squeezeDuplicates(maxima_coords, workspace.sortBuffer);
+}
+
 template <class T>
 void wienerStormSingleFrame(const MultiArrayView<2, T>& in, const BasicImage<T>& filter, 
-            std::set<Coord<T> >& maxima_coords, 
+            std::vector<Coord<T> >& maxima_coords, 
             FFTFilter<T> & fftwWrapper,
+            FrameWorkspace<T> & workspace,
             const T threshold=800, const int factor=8, const int mylen=9,
-            const char verbose=0) {
+            const char verbose=0, const StormOptions& options=StormOptions(),
+            const BasicImage<T> * background=0, const FrameTiling<T> * tiling=0) {
+    workspace.upsamplingChoices.clear();
+    if(tiling) {
+        wienerStormTiledFrame(in, *tiling, maxima_coords, workspace, 
+                threshold, factor, mylen, options, background);
+        return;
+    }
 
     unsigned int w = in.shape(0); // width
     unsigned int h = in.shape(1); // height
-    BasicImage<T> filtered(w,h);
-    BasicImage<T> bg(w,h);        // background
-    // ROI:
-    const int mylen2 = mylen/2;
-    unsigned int w_roi = factor*(mylen-1)+1;
-    unsigned int h_roi = factor*(mylen-1)+1;
-    BasicImage<T> im_xxl(w_roi, h_roi);
+    workspace.reshape(w, h, factor, mylen); // no-op for all but the first frame
+    typedef typename FrameWorkspace<T>::ImageView ImageView;
+    ImageView & filtered = workspace.filtered;
+    ImageView & bg = workspace.bg;        // background
 
     BasicImageView<T> input = makeBasicImageView(in);  // access data as BasicImage
 
     //fft, filter with Wiener filter in frequency domain, inverse fft, take real part
-    BasicImageView<T> filteredView(filtered.data(), filtered.size());
-    fftwWrapper.applyFourierFilter(srcImageRange(input), srcImage(filter), destImage(filteredView));
+    // With the spatial background, the normalization of the inverse fft, 
+    // the background and the search for candidates are fused into 
+    // the passes of the background filter.
+    const bool fused = !background;
+    fftwWrapper.applyFourierFilter(srcImageRange(input), srcImage(filter), destImage(filtered),
+            workspace.complexImg, !fused);
     //~ vigra::gaussianSmoothing(srcImageRange(input), destImage(filtered), 1.2);
-    subtractBackground(filtered, bg);
-    vigra::FindMinMax<T> bgMinmax;
-    vigra::inspectImage(srcImageRange(bg), bgMinmax);
-    T baseline = bgMinmax.min;
-
-    std::set<Coord<T> > maxima_candidates_vect;  // we use a set for the coordinates to automatically squeeze duplicates 
-                                                 // (from overlapping ROIs)
-    VectorPushAccessor<Coord<T>, typename BasicImage<T>::const_traverser> maxima_candidates(maxima_candidates_vect, filtered.upperLeft());
-    vigra::localMaxima(srcImageRange(filtered), destImage(filtered, maxima_candidates), vigra::LocalMinmaxOptions().threshold(threshold));
 
-    VectorPushAccessor<Coord<T>, typename BasicImage<T>::const_traverser> maxima_acc(maxima_coords, im_xxl.upperLeft());
-
-    //upscale filtered image regions with spline interpolation
-    std::set<Coord<float> >::iterator it2;
-    for(it2=maxima_candidates_vect.begin(); it2 != maxima_candidates_vect.end(); it2++) {
-            Coord<float> c = *it2;
-            if(filtered(c.x,c.y)<(bg(c.x,c.y)-baseline)) { // skip very low signals
-                continue;
-            }
-            Diff2D roi_ul (c.x-mylen2, c.y-mylen2);
-            Diff2D roi_lr (c.x-mylen2+mylen, c.y-mylen2+mylen);
-
-            Diff2D xxl_ul (0, 0);  // offset in xxl image
-            Diff2D xxl_lr (0, 0);
-
-            // Maxima-Candidates near the border
-            if(c.x-mylen2<0 || c.y-mylen2<0 || c.x-mylen2+mylen>(int)w || c.y-mylen2+mylen>(int)h) {
-                Diff2D _roi_ul (
-                    ((c.x-mylen2)<0) ? 0 : (c.x-mylen2),
-                    ((c.y-mylen2)<0) ? 0 : (c.y-mylen2) );
-                Diff2D _roi_lr (
-                    ((c.x-mylen2+mylen)>(int)w) ? w : (c.x-mylen2+mylen),
-                    ((c.y-mylen2+mylen)>(int)h) ? h : (c.y-mylen2+mylen) );
-
-                xxl_ul += (_roi_ul-roi_ul)*factor; // offset in xxl image
-                xxl_lr += (_roi_lr-roi_lr)*factor;
-                roi_ul = _roi_ul;
-                roi_lr = _roi_lr;
-            }
-
-            vigra::resizeImageSplineInterpolation(
-                    srcIterRange(filtered.upperLeft()+roi_ul, filtered.upperLeft()+roi_lr), 
-                    destIterRange(im_xxl.upperLeft()+xxl_ul, im_xxl.lowerRight()+xxl_lr),
-                    BSplineWOPrefilter<3,double>());
-            // find local maxima that are above a given threshold
-            // at least the values should be above background+baseline
-            // here we include only internal pixels, no border
-            // to get every maximum only once, the maxima are pushed into a std::set
-            maxima_acc.setOffset(Diff2D(factor*(c.x-mylen2), factor*(c.y-mylen2)));
-            vigra::localMaxima(srcIterRange(im_xxl.upperLeft()+xxl_ul+Diff2D(factor,factor), im_xxl.lowerRight()+xxl_lr-Diff2D(factor,factor)),
-                    destIter(im_xxl.upperLeft()+xxl_ul+Diff2D(factor,factor), maxima_acc), vigra::LocalMinmaxOptions().threshold(threshold));
+    // the maxima are found row by row, so the candidates are sorted and unique
+    std::vector<Coord<T> > & maxima_candidates_vect = workspace.candidates;
+    maxima_candidates_vect.clear();
+    T baseline; // minimum of the background
+    if(fused) {
+        std::vector<int> & indices = workspace.candidateIndices;
+        baseline = workspace.backgroundFilter.subtract(filtered, bg, fftwWrapper.normalization(), 
+                threshold, indices);
+        pushIndices(filtered.data(), (int)w, indices.empty() ? 0 : &indices[0], indices.size(),
+                Diff2D(0,0), maxima_candidates_vect);
+    } else { // (filtered) snapshot of a TemporalBackground
+        baseline = subtractBackground(filtered, bg, *background);
+        pushLocalMaxima(filtered, Diff2D(0,0), Diff2D(w,h), threshold, Diff2D(0,0),
+                workspace.maximaIndices, maxima_candidates_vect);
     }
-    determineAsymmetry(srcImageRange(filtered), maxima_coords, factor);
+
+    localizeCandidates(input, filtered, bg, baseline, maxima_candidates_vect, maxima_coords,
+            threshold, factor, mylen, options, workspace);
 }
@@ -30,13 +30,13 @@
 
 // Draw all coordinates into the resulting image
 template <class C, class Image>
-void drawCoordsToImage(std::vector<std::set<C> >& coords, Image& res) {
+void drawCoordsToImage(std::vector<std::vector<C> >& coords, Image& res) {
 	res = 0;
 	//  loop over the coordinates
-	typename std::vector<std::set<C> >::iterator it;
-	typename std::set<C>::iterator it2;
+	typename std::vector<std::vector<C> >::iterator it;
+	typename std::vector<C>::iterator it2;
 	for(it = coords.begin(); it != coords.end(); ++it) {
-		std::set<C> r = *it;
+		std::vector<C>& r = *it;
 		for(it2 = r.begin(); it2 != r.end(); it2++) {
 			C c = *it2;
 			res(c.x, c.y) += c.val;